@@ -0,0 +1,99 @@
+// Riepilogo e confronto dei report JSON prodotti da kcomp -ftime-report=json.
+//   kbench summary <risultati>             throughput (righe/s) e memoria per fase
+//   kbench compare <baseline> <risultati>  confronto con una baseline; termina con
+//                                          codice 1 se un carico peggiora oltre la soglia
+// Ogni file contiene un record JSON per riga, uno per modulo compilato.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+using namespace llvm;
+
+// Misure di un carico: righe di sorgente, tempo totale e picco di memoria
+struct result {
+  double lines = 0;
+  double wall = 0;
+  double peakrss = 0;
+  std::map<std::string, std::pair<double, double>> phases; // fase -> (wall, picco RSS)
+};
+
+static bool load(const char* f, std::map<std::string, result>& results) {
+  auto buf = MemoryBuffer::getFile(f);
+  if (!buf) {
+    fprintf(stderr, "impossibile leggere %s\n", f);
+    return false;
+  }
+  StringRef rest = (*buf)->getBuffer();
+  while (!rest.empty()) {
+    StringRef line;
+    std::tie(line, rest) = rest.split('\n');
+    if (line.trim().empty())
+      continue;
+    Expected<json::Value> v = json::parse(line);
+    if (!v) {
+      fprintf(stderr, "%s: record non valido: %s\n", f, toString(v.takeError()).c_str());
+      return false;
+    }
+    json::Object* o = v->getAsObject();
+    result& r = results[o->getString("file").value_or("").str()];
+    r.lines = o->getNumber("lines").value_or(0);
+    // I record precedenti chiamavano peak_rss_kb il picco del processo
+    r.peakrss = o->getNumber("process_peak_rss_kb")
+                  .value_or(o->getNumber("peak_rss_kb").value_or(0));
+    if (json::Array* phases = o->getArray("phases"))
+      for (auto& p : *phases) {
+        json::Object* po = p.getAsObject();
+        double wall = po->getNumber("wall").value_or(0);
+        r.wall += wall;
+        r.phases[po->getString("name").value_or("").str()] =
+          { wall, po->getNumber("process_peak_rss_kb")
+                    .value_or(po->getNumber("peak_rss_kb").value_or(0)) };
+      }
+  }
+  return true;
+}
+
+static double throughput(const result& r) {
+  return r.wall > 0 ? r.lines / r.wall : 0;
+}
+
+int main(int argc, char *argv[]) {
+  std::map<std::string, result> base, cur;
+  if (argc == 3 && !strcmp(argv[1], "summary")) {
+    if (!load(argv[2], cur))
+      return 1;
+    for (auto& w : cur) {
+      printf("%-20s %10.0f righe %10.4f s %12.0f righe/s %10.0f KiB\n", w.first.c_str(),
+             w.second.lines, w.second.wall, throughput(w.second), w.second.peakrss);
+      for (auto& p : w.second.phases)
+        printf("    %-16s %10.4f s %10.0f KiB\n", p.first.c_str(), p.second.first, p.second.second);
+    }
+    return 0;
+  }
+  if (argc >= 4 && !strcmp(argv[1], "compare")) {
+    double threshold = argc > 4 ? atof(argv[4]) : 10.0; // peggioramento tollerato (%)
+    if (!load(argv[2], base) || !load(argv[3], cur))
+      return 1;
+    int regressions = 0;
+    for (auto& w : cur) {
+      auto b = base.find(w.first);
+      if (b == base.end()) {
+        printf("%-20s assente nella baseline\n", w.first.c_str());
+        continue;
+      }
+      double speed = 100.0 * (throughput(w.second) / throughput(b->second) - 1);
+      double memory = 100.0 * (w.second.peakrss / b->second.peakrss - 1);
+      bool worse = speed < -threshold || memory > threshold;
+      regressions += worse;
+      printf("%-20s righe/s %+7.1f%%  picco RSS %+7.1f%%%s\n", w.first.c_str(),
+             speed, memory, worse ? "  PEGGIORAMENTO" : "");
+    }
+    return regressions ? 1 : 0;
+  }
+  fprintf(stderr, "uso: %s summary <risultati> | compare <baseline> <risultati> [soglia %%]\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,97 @@
+// Generatore di programmi Kaleidoscope sintetici per misurare le prestazioni di kcomp.
+// Le dimensioni del programma sono configurabili dalla linea di comando:
+//   -f N   numero di funzioni
+//   -e N   lunghezza delle catene di espressioni (numero di operandi)
+//   -d N   profondità di annidamento di if/for/blocchi
+//   -p N   numero di parametri di ogni funzione (e di argomenti di ogni chiamata)
+//   -g N   numero di variabili globali
+//   -s N   seme del generatore pseudocasuale
+// Il programma viene scritto su stdout.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+static std::mt19937 rng;
+static int functions = 100, exprlen = 8, depth = 2, params = 2, globals = 0;
+
+static int pick(int n) {
+  return std::uniform_int_distribution<int>(0, n-1)(rng);
+}
+
+// Operando di un'espressione: un parametro, una variabile globale o una costante
+static std::string operand() {
+  int k = pick(globals ? 3 : 2);
+  if (k == 0)
+    return "a" + std::to_string(pick(params));
+  if (k == 1)
+    return std::to_string(pick(100)) + "." + std::to_string(pick(10));
+  return "g" + std::to_string(pick(globals));
+}
+
+// Catena di espressioni di lunghezza exprlen, con gli operatori aritmetici del linguaggio
+static std::string chain() {
+  static const char* ops[] = { " + ", " - ", " * ", " / " };
+  std::string e = operand();
+  for (int i = 1; i < exprlen; i++) {
+    e += ops[pick(4)];
+    e += operand();
+  }
+  return e;
+}
+
+// Statement annidato fino a profondità d: if/else, for e blocchi con variabili locali
+static std::string nested(int d) {
+  if (d == 0)
+    return "t = t + " + chain();
+  std::string id = std::to_string(d);
+  switch (pick(3)) {
+  case 0:
+    // Solo il ramo then viene annidato, così che la dimensione resti lineare in d
+    return "if (t < " + operand() + ") " + nested(d-1) + " else t = t - 1";
+  case 1:
+    return "for (var i" + id + " = 0; i" + id + " < 3; ++i" + id + ") " + nested(d-1);
+  default:
+    return "{ var v" + id + " = " + chain() + "; t = t + v" + id + "; " + nested(d-1) + " }";
+  }
+}
+
+int main(int argc, char *argv[]) {
+  unsigned seed = 1;
+  for (int i = 1; i+1 < argc; i += 2) {
+    int v = atoi(argv[i+1]);
+    if (!strcmp(argv[i], "-f")) functions = v;
+    else if (!strcmp(argv[i], "-e")) exprlen = v;
+    else if (!strcmp(argv[i], "-d")) depth = v;
+    else if (!strcmp(argv[i], "-p")) params = v;
+    else if (!strcmp(argv[i], "-g")) globals = v;
+    else if (!strcmp(argv[i], "-s")) seed = v;
+    else {
+      fprintf(stderr, "uso: %s [-f N] [-e N] [-d N] [-p N] [-g N] [-s N]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (params < 1) params = 1;
+  if (exprlen < 1) exprlen = 1;
+  rng.seed(seed);
+
+  for (int g = 0; g < globals; g++)
+    printf("global g%d;\n", g);
+
+  for (int f = 0; f < functions; f++) {
+    printf("def f%d(", f);
+    for (int p = 0; p < params; p++)
+      printf(p ? " a%d" : "a%d", p);
+    printf(") {\n  var t = %s;\n  %s;\n  ", chain().c_str(), nested(depth).c_str());
+    // Ogni funzione chiama la precedente, con la lista completa degli argomenti
+    if (f > 0) {
+      printf("t + f%d(", f-1);
+      for (int p = 0; p < params; p++)
+        printf(p ? ", %s" : "%s", chain().c_str());
+      printf(")\n};\n");
+    } else
+      printf("t\n};\n");
+  }
+  return 0;
+}
@@ -1,11 +1,6 @@
 #include "driver.hpp"
 #include "parser.hpp"
-
-// Generazione di un'istanza per ciascuna della classi LLVMContext, Module e IRBuilder. 
-// Nel caso di singolo modulo è sufficiente
-LLVMContext *context = new LLVMContext;
-Module *module = new Module("Kaleidoscope", *context);
-IRBuilder<> *builder = new IRBuilder(*context); // costruiscono le istruzioni del codice intermedio
+#include "runtime/krt.h"
 
 Value *LogErrorV(const std::string Str) {
   std::cerr << Str << std::endl;
@@ -20,50 +15,1235 @@ Value *LogErrorV(const std::string Str) {
    La chiamata di questa utility restituisce un'istruzione IR che alloca un double in memoria e ne memorizza il puntatore in un registro SSA cui viene attribuito il nome passato come secondo parametro. 
    L'istruzione verrà scritta all'inizio dell'entry block della funzione passata come primo parametro.
    Si ricordi che le istruzioni sono generate da un builder. 
-   Per non interferire con il builder globale, che tiene traccia di dove è arrivato a costruire, la generazione viene dunque effettuata con un builder temporaneo TmpB
+   Per non interferire con il builder del driver, che tiene traccia di dove è arrivato a costruire, la generazione viene dunque effettuata con un builder temporaneo TmpB
 */
-static AllocaInst *CreateEntryBlockAlloca(Function *fun, StringRef VarName) {
+static AllocaInst *CreateEntryBlockAlloca(Function *fun, StringRef VarName, Type *T = nullptr) {
   IRBuilder<> TmpB(&fun->getEntryBlock(), fun->getEntryBlock().begin()); // una funzione è fatta di basic blocks e il builder temporaneo inizia a scrivere nell'entry block della funzione
-  return TmpB.CreateAlloca(Type::getDoubleTy(*context), nullptr, VarName); // NON alloca il valore della variabile perché controllato a tempo di compilazione
+  if (!T) // il tipo di default è double; array e parametri array hanno un tipo proprio
+    T = Type::getDoubleTy(fun->getContext());
+  return TmpB.CreateAlloca(T, nullptr, VarName); // NON alloca il valore della variabile perché controllato a tempo di compilazione
+}
+
+// Allineamento della memoria degli array: una linea di cache, in modo che i cicli
+// vettorizzati accedano a dati allineati e che array diversi non condividano linee
+static const Align ArrayAlign(64);
+
+// Restituisce l'area di memoria di una variabile: l'alloca di una variabile locale
+// (symbol table) oppure una variabile globale del modulo; nullptr se non è definita
+static Value *LookupVar(driver& drv, const Symbol* sym) {
+  if (AllocaInst *A = drv.NamedValues.lookup(sym))
+    return A;
+  return drv.module->getNamedGlobal(sym->name);
+}
+
+// Indirizzo del primo elemento se la variabile (area di memoria restituita da
+// LookupVar) è un array, nullptr se è uno scalare. Gli array locali di dimensione
+// costante e quelli globali hanno tipo [N x double], gli array locali di dimensione
+// variabile sono alloca di N double, mentre i parametri array sono puntatori,
+// memorizzati a loro volta in un'alloca come gli altri parametri
+static Value *ArrayBase(driver& drv, Value *Var, StringRef name) {
+  if (AllocaInst *A = dyn_cast<AllocaInst>(Var)) {
+    if (A->getAllocatedType()->isArrayTy() || A->isArrayAllocation())
+      return A;
+    if (A->getAllocatedType()->isPointerTy())
+      return drv.builder->CreateLoad(A->getAllocatedType(), A, name);
+    return nullptr;
+  }
+  if (cast<GlobalVariable>(Var)->getValueType()->isArrayTy())
+    return Var;
+  return nullptr;
+}
+
+// Indirizzo dell'elemento Index dell'array che inizia in Base. L'indice è un double
+// e viene troncato ad intero; non viene effettuato alcun controllo sui limiti
+static Value *ElementPtr(driver& drv, Value *Base, ExprAST *Index) {
+  Value *Idx = Index->codegen(drv);
+  if (!Idx)
+    return nullptr;
+  Idx = drv.builder->CreateFPToSI(Idx, Type::getInt64Ty(*drv.context), "idx");
+  return drv.builder->CreateInBoundsGEP(Type::getDoubleTy(*drv.context), Base, Idx, "elemptr");
 }
 
 // Implementazione del costruttore della classe driver
-driver::driver(): trace_parsing(false), trace_scanning(false) {};
+// Ogni driver possiede un'istanza delle classi LLVMContext, Module e IRBuilder:
+// compilazioni indipendenti (es. file diversi compilati in parallelo) non
+// condividono alcuno stato
+driver::driver(): evalbudget(0), trace_parsing(false), trace_scanning(false),
+                  buffer(nullptr), length(0), mapped(0),
+                  optlevel(0), nobuiltin(false), veclib(TargetLibraryInfoImpl::NoLibrary),
+                  instrument_calls(false), instrument_loops(false), pgo(PGOOptions::NoAction),
+                  stream_ir(true), target(nullptr), partitions(1),
+                  context(std::make_unique<LLVMContext>()),
+                  module(std::make_unique<Module>("Kaleidoscope", *context)),
+                  builder(std::make_unique<IRBuilder<>>(*context)),
+                  time_report(false), replstatus(0), cacheerror(false), astnodes(0), lines(0), bytes(0) {};
+
+driver::~driver() {
+  release();
+};
 
 // Implementazione del metodo parse
 int driver::parse (const std::string &f) {
+  release();                   // Eventuale AST residuo di un parsing fallito
   file = f;                    // File con il programma
   location.initialize(&file);  // Inizializzazione dell'oggetto location
-  scan_begin();                // Inizio scanning (ovvero apertura del file programma)
+  TimeRecord start = TimeRecord::getCurrentTime(true);
+  if (!scan_begin())           // Inizio scanning (ovvero mappatura in memoria del file programma)
+    return 1;
+  // Con la cache il parser registra il sorgente delle definizioni, individuato da
+  // riga e colonna: l'inizio delle righe va calcolato prima che lo scanner inizi a
+  // modificare (temporaneamente) il buffer
+  linestarts.clear();
+  if (!cachedir.empty()) {
+    linestarts.push_back(0);
+    for (size_t i = 0; i < length; i++)
+      if (buffer[i] == '\n')
+        linestarts.push_back(i + 1);
+  }
   yy::parser parser(*this);    // Istanziazione del parser
   parser.set_debug_level(trace_parsing); // Livello di debug del parser
   int res = parser.parse();    // Chiamata dell'entry point del parser
-  scan_end();                  // Fine scanning (ovvero chiusura del file programma)
+  lines += location.end.line;
+  bytes += length;
+  scan_end();                  // Fine scanning (ovvero rilascio del file programma)
+  astnodes += nodes.size();
+  endphase("scan/parse", start);
   return res;
 }
 
+// Implementazione del metodo parse_string: il sorgente è già in memoria e viene
+// analizzato sul posto (se il chiamante lo cede con std::move non viene copiato),
+// dopo avervi accodato i due caratteri nulli che flex richiede come terminatori
+int driver::parse_string (std::string text, const std::string& name) {
+  source = std::move(text);
+  length = source.size();
+  source.append(2, '\0');
+  buffer = &source[0];
+  return parse(name);
+}
+
 // Implementazione del metodo codegen, che è una "semplice" chiamata del 
 // metodo omonimo presente nel nodo root (il puntatore root è stato scritto dal parser)
 void driver::codegen() {
+  TimeRecord start = TimeRecord::getCurrentTime(true);
+  if (builder)                 // Nel REPL il builder è creato per ogni elemento
+    builder->setFastMathFlags(fmf); // Flag applicati a tutte le operazioni floating point
   root->codegen(*this);
+  release();                   // Terminata la codegen l'AST non serve più
+  endphase("codegen", start);
+};
+
+// Implementazione del metodo release. Poiché tutti i nodi vivono nell'arena,
+// è sufficiente invocarne i distruttori e poi restituire i blocchi dell'arena
+void driver::release() {
+  for (RootAST* node : nodes)
+    node->~RootAST();
+  nodes.clear();
+  arena.Reset();
+  root = nullptr;
+  purefuns.clear();            // Le funzioni pure sono nodi dell'AST appena distrutto
+  evalfailures.clear();
+  sources.clear();
+};
+
+// Implementazione del metodo intern. Lo scanner restituisce al parser, per ogni
+// identificatore, il simbolo unico corrispondente al suo testo: confronti e
+// ricerche nella symbol table avvengono così sul simbolo e non sulla stringa
+const Symbol* driver::intern(StringRef text) {
+  auto entry = identifiers.try_emplace(text);
+  Symbol &sym = entry.first->second;
+  if (entry.second) {
+    sym.name = entry.first->first();
+    sym.id = identifiers.size() - 1;
+  }
+  return &sym;
 };
 
+/*********************** Compile-time evaluation ***********************/
+// Limiti dell'interprete: passi (chiamate e iterazioni dei cicli) per ogni
+// chiamata da valutare e per l'intero sorgente, così che la valutazione non domini
+// il tempo di compilazione, e profondità della ricorsione, che usa lo stack del
+// compilatore
+static const unsigned EvalSteps = 100000;
+static const unsigned EvalBudget = 10000000;
+static const unsigned EvalDepth = 1000;
+
+Evaluator::Evaluator(const std::map<const Symbol*, FunctionAST*>& functions, unsigned steps,
+                     EvalFailures& failures):
+  functions(functions), failures(failures), steps(steps), depth(0) {};
+
+// Le variabili sono celle di una deque, i cui elementi non vengono spostati
+// quando se ne aggiungono altri: i puntatori nella tabella restano validi
+void Evaluator::bind(const Symbol* sym, double val) {
+  cells.push_back(val);
+  values.bind(sym, &cells.back());
+};
+
+bool Evaluator::call(const Symbol* callee, const std::vector<double>& args, double& val) {
+  auto F = functions.find(callee);
+  if (F == functions.end())
+    return false;
+  used.insert(callee);
+  // Una chiamata fallita con l'intero limite di passi fallisce anche con meno passi
+  auto Failed = failures.find({callee, args});
+  if (Failed != failures.end()) {
+    used.insert(Failed->second.begin(), Failed->second.end());
+    return false;
+  }
+  if (!steps || depth == EvalDepth)
+    return false;
+  unsigned start = steps;
+  steps--;
+  depth++;
+  bool ok = F->second->eval(*this, args, val);
+  depth--;
+  // Solo l'esito di una chiamata iniziata con l'intero limite non dipende dai
+  // passi consumati in precedenza, e può essere riutilizzato
+  if (!ok && depth == 0 && start == EvalSteps)
+    failures[{callee, args}] = used;
+  return ok;
+};
+
+// Implementazione del metodo optimize. Il modulo viene ottimizzato solo dopo che la
+// codegen di tutti i file è terminata, utilizzando il new PassManager di LLVM:
+// si registrano le analisi ai quattro livelli (loop, funzione, CGSCC, modulo) e si
+// costruisce la pipeline di default del livello richiesto oppure quella descritta
+// testualmente dall'utente con -passes= (stessa sintassi di opt)
+int driver::optimize() {
+  // Prima di ottimizzare ci si assicura che il modulo sia ben formato: le pipeline
+  // di LLVM assumono IR valido e potrebbero altrimenti terminare in modo anomalo
+  if (verifyModule(*module, &errs())) {
+    std::cerr << "Modulo non valido: ottimizzazione non eseguita" << std::endl;
+    return 1;
+  }
+  // Con la cache ogni definizione è già stata ottimizzata nel proprio modulo
+  if (!cachedir.empty())
+    return cacheerror;
+  lowerbuiltins(*module);
+
+  // Con -ftime-report si registra la dimensione di ogni funzione prima e dopo
+  // l'ottimizzazione (le funzioni eliminate, es. perché inlined, restano a 0)
+  if (time_report)
+    for (auto &F : *module)
+      if (!F.isDeclaration())
+        instcount[F.getName().str()].first = F.getInstructionCount();
+  TimeRecord start = TimeRecord::getCurrentTime(true);
+  if (optimize(*module))
+    return 1;
+  endphase("optimize", start);
+  if (time_report)
+    for (auto &F : *module)
+      if (!F.isDeclaration())
+        instcount[F.getName().str()].second = F.getInstructionCount();
+  return 0;
+};
+
+// Funzioni di libreria note ai passi, sia dell'ottimizzatore sia del backend: con
+// -fno-builtin nessuna chiamata viene riconosciuta (né semplificata o espansa),
+// con -fveclib= le chiamate nei cicli possono essere sostituite dalle versioni
+// vettoriali della libreria indicata
+TargetLibraryInfoImpl driver::libinfo(const Module& M) const {
+  Triple triple(M.getTargetTriple());
+  TargetLibraryInfoImpl TLII(triple);
+  if (nobuiltin)
+    TLII.disableAllFunctions();
+  TLII.addVectorizableFunctionsFromVecLib(veclib, triple);
+  return TLII;
+};
+
+int driver::optimize(Module& M) {
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  TargetLibraryInfoImpl TLII = libinfo(M);
+  FAM.registerPass([&] { return TargetLibraryAnalysis(TLII); });
+  // Con un profilo le pipeline di default (anche quella di -O0) inseriscono la
+  // strumentazione dei rami e delle funzioni, oppure annotano le funzioni con il
+  // numero di chiamate e i rami con i pesi misurati prima di ottimizzare
+  std::optional<PGOOptions> PGO;
+  if (pgo != PGOOptions::NoAction)
+    PGO = PGOOptions(profile, "", "", "", vfs::getRealFileSystem(), pgo);
+  // Con il target le pipeline dispongono dei costi reali delle istruzioni
+  PassBuilder PB(target, PipelineTuningOptions(), PGO);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  if (!passes.empty()) {
+    if (Error Err = PB.parsePassPipeline(MPM, passes)) {
+      std::cerr << "Pipeline non valida: " << toString(std::move(Err)) << std::endl;
+      return 1;
+    }
+  } else {
+    switch (optlevel) {
+    case 0:
+      MPM = PB.buildO0DefaultPipeline(OptimizationLevel::O0);
+      break;
+    case 1:
+      MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O1);
+      break;
+    case 2:
+      MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O2);
+      break;
+    default:
+      MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O3);
+    }
+  }
+  MPM.run(M, MAM);
+  return 0;
+};
+
+// Funzioni di libm riconosciute negli extern: nome, numero di parametri e intrinsic
+// corrispondente. L'intrinsic non modifica errno, per cui i passi possono calcolarlo
+// a tempo di compilazione, spostarlo fuori dai cicli, vettorizzarlo e, nel caso di
+// sqrt, fabs, floor e ceil, il backend lo traduce in una sola istruzione
+static const struct {
+  const char *name;
+  unsigned arity;
+  Intrinsic::ID id;
+} Builtins[] = {
+  { "sqrt", 1, Intrinsic::sqrt }, { "floor", 1, Intrinsic::floor },
+  { "ceil", 1, Intrinsic::ceil }, { "fabs", 1, Intrinsic::fabs },
+  { "exp", 1, Intrinsic::exp },   { "log", 1, Intrinsic::log },
+  { "pow", 2, Intrinsic::pow },   { "sin", 1, Intrinsic::sin },
+  { "cos", 1, Intrinsic::cos },   { "fma", 3, Intrinsic::fma },
+};
+
+// Implementazione del metodo lowerbuiltins. Un extern con il nome (e i parametri)
+// di una funzione di libm si riferisce alla funzione della libreria standard, come
+// in C: le sue chiamate diventano chiamate all'intrinsic. Le funzioni definite nel
+// programma non sono toccate, così come le definizioni caricate dalla cache o
+// generate in precedenza nel REPL, che nel modulo compaiono come dichiarazioni
+void driver::lowerbuiltins(Module& M) {
+  if (nobuiltin)
+    return;
+  Type *DoubleTy = Type::getDoubleTy(M.getContext());
+  for (auto &B : Builtins) {
+    Function *F = M.getFunction(B.name);
+    if (!F || !F->isDeclaration() || F->arg_size() != B.arity)
+      continue;
+    auto Sym = identifiers.find(B.name);
+    auto R = replfuns.find(B.name);
+    if ((Sym != identifiers.end() && cached.count(&Sym->second)) ||
+        (R != replfuns.end() && R->second.version > 0))
+      continue;
+    if (!std::all_of(F->arg_begin(), F->arg_end(),
+                     [&](const Argument& A) { return A.getType() == DoubleTy; }))
+      continue;
+    Function *Intr = Intrinsic::getDeclaration(&M, B.id, { DoubleTy });
+    // La nuova chiamata conserva i flag fast-math, ma non l'eventuale musttail:
+    // l'intrinsic non è una funzione a cui si possa saltare
+    for (auto U = F->user_begin(); U != F->user_end(); ) {
+      CallInst *Call = dyn_cast<CallInst>(*U++);
+      if (!Call || Call->getCalledFunction() != F)
+        continue;
+      IRBuilder<> B(Call);
+      std::vector<Value*> Args(Call->arg_begin(), Call->arg_end());
+      CallInst *New = B.CreateCall(Intr, Args);
+      New->copyFastMathFlags(Call);
+      New->takeName(Call);
+      Call->replaceAllUsesWith(New);
+      Call->eraseFromParent();
+    }
+    if (F->use_empty())
+      F->eraseFromParent();
+  }
+};
+
+// Implementazione del metodo inittarget. Viene costruita la TargetMachine della
+// macchina host e ne vengono impostati triple e data layout nel modulo prima della
+// codegen, in modo che sia l'IR generato sia le ottimizzazioni ne tengano conto
+int driver::inittarget() {
+  // La registrazione del target è globale al processo: va eseguita una sola volta,
+  // anche quando più driver vengono inizializzati da thread diversi
+  static std::once_flag initialized;
+  std::call_once(initialized, [] {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+  });
+
+  std::string triple = sys::getDefaultTargetTriple();
+  std::string error;
+  const Target *T = TargetRegistry::lookupTarget(triple, error);
+  if (!T) {
+    std::cerr << "Target non disponibile: " << error << std::endl;
+    return 1;
+  }
+
+  std::string hostcpu = cpu == "native" ? sys::getHostCPUName().str() : cpu;
+  std::string features;
+  if (cpu == "native") {
+    // Con -mcpu=native si abilitano tutte le estensioni supportate dalla CPU host
+    StringMap<bool> hostfeatures;
+    if (sys::getHostCPUFeatures(hostfeatures))
+      for (auto &F : hostfeatures)
+        features += (F.second ? "+" : "-") + F.first().str() + ",";
+  }
+  // Il livello di ottimizzazione del backend segue quello della pipeline IR
+  CodeGenOpt::Level level = optlevel == 0 ? CodeGenOpt::None :
+                            optlevel == 1 ? CodeGenOpt::Less :
+                            optlevel == 2 ? CodeGenOpt::Default : CodeGenOpt::Aggressive;
+  // Le ipotesi floating point richieste valgono anche per il backend, che può così
+  // fondere moltiplicazioni e addizioni in FMA anche fra istruzioni diverse
+  TargetOptions opt;
+  if (fmf.allowContract())
+    opt.AllowFPOpFusion = FPOpFusion::Fast;
+  opt.UnsafeFPMath = fmf.isFast();
+  opt.NoNaNsFPMath = fmf.noNaNs();
+  opt.NoInfsFPMath = fmf.noInfs();
+  opt.NoSignedZerosFPMath = fmf.noSignedZeros();
+  target = T->createTargetMachine(triple, hostcpu.empty() ? "generic" : hostcpu,
+                                  features, opt, Reloc::PIC_, std::nullopt, level);
+
+  module->setTargetTriple(triple);
+  module->setDataLayout(target->createDataLayout());
+  return 0;
+};
+
+// Implementazione del metodo emit. Il modulo (eventualmente ottimizzato) viene
+// tradotto direttamente in codice oggetto o assembly dalla pipeline di codegen
+// di LLVM, senza passare per il file .ll e per llvm-as/llc/as
+int driver::emit(const std::string& f, CodeGenFileType type) {
+  if (partitions > 1 && type == CGFT_ObjectFile)
+    return emitsplit(f);
+  std::error_code EC;
+  raw_fd_ostream dest(f, EC, sys::fs::OF_None);
+  if (EC) {
+    std::cerr << "Impossibile aprire " << f << ": " << EC.message() << std::endl;
+    return 1;
+  }
+  TimeRecord start = TimeRecord::getCurrentTime(true);
+  legacy::PassManager pass;
+  TargetLibraryInfoImpl TLII = libinfo(*module);
+  pass.add(new TargetLibraryInfoWrapperPass(TLII));
+  if (target->addPassesToEmitFile(pass, dest, nullptr, type)) {
+    std::cerr << "Il target non supporta l'emissione del tipo di file richiesto" << std::endl;
+    return 1;
+  }
+  pass.run(*module);
+  dest.flush();
+  endphase("emit", start);
+  return 0;
+};
+
+// Implementazione del metodo emitsplit. Con -fparallel-codegen=N il modulo viene
+// diviso in N parti (SplitModule), ognuna delle quali viene tradotta in codice
+// oggetto su un proprio thread, con propri LLVMContext e TargetMachine. I simboli
+// interni usati da più parti diventano hidden, per cui gli oggetti vengono riuniti
+// da "ld -r" nell'unico file rilocabile f
+int driver::emitsplit(const std::string& f) {
+  auto ld = sys::findProgramByName("ld");
+  if (!ld) {
+    std::cerr << "-fparallel-codegen richiede il linker ld" << std::endl;
+    return 1;
+  }
+  TimeRecord start = TimeRecord::getCurrentTime(true);
+  // Le parti passano fra i thread come bitcode, perché ogni contesto LLVM può
+  // essere usato da un solo thread alla volta
+  std::vector<SmallString<0>> parts;
+  SplitModule(*module, partitions, [&](std::unique_ptr<Module> part) {
+    parts.emplace_back();
+    raw_svector_ostream out(parts.back());
+    WriteBitcodeToFile(*part, out);
+  });
+
+  std::vector<std::string> objects(parts.size());
+  std::vector<int> status(parts.size(), 0);
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < parts.size(); i++)
+    workers.emplace_back([&, i] {
+      status[i] = 1;
+      LLVMContext C;
+      auto M = parseBitcodeFile(MemoryBufferRef(parts[i], "part"), C);
+      if (!M) {
+        std::cerr << toString(M.takeError()) << std::endl;
+        return;
+      }
+      std::unique_ptr<TargetMachine> TM(target->getTarget().createTargetMachine(
+          target->getTargetTriple().str(), target->getTargetCPU(),
+          target->getTargetFeatureString(), target->Options,
+          target->getRelocationModel(), target->getCodeModel(), target->getOptLevel()));
+      SmallString<128> path;
+      int fd;
+      if (sys::fs::createTemporaryFile("kcomp", "o", fd, path))
+        return;
+      objects[i] = path.str().str();
+      raw_fd_ostream dest(fd, true);
+      legacy::PassManager pass;
+      TargetLibraryInfoImpl TLII = libinfo(**M);
+      pass.add(new TargetLibraryInfoWrapperPass(TLII));
+      if (TM->addPassesToEmitFile(pass, dest, nullptr, CGFT_ObjectFile))
+        return;
+      pass.run(**M);
+      dest.flush();
+      status[i] = 0;
+    });
+  for (auto &w : workers)
+    w.join();
+
+  int res = 0;
+  std::vector<StringRef> args = { *ld, "-r", "-o", f };
+  for (unsigned i = 0; i < parts.size(); i++) {
+    if (status[i])
+      res = 1;
+    if (!objects[i].empty())
+      args.push_back(objects[i]);
+  }
+  if (res)
+    std::cerr << "Emissione del codice oggetto non riuscita" << std::endl;
+  else if (sys::ExecuteAndWait(*ld, args)) {
+    std::cerr << "Collegamento delle parti di " << f << " non riuscito" << std::endl;
+    res = 1;
+  }
+  for (auto &o : objects)
+    if (!o.empty())
+      sys::fs::remove(o);
+  endphase("emit", start);
+  return res;
+};
+
+// Implementazione del metodo emit_ir. L'intero modulo viene scritto una sola volta,
+// attraverso lo stream bufferizzato di un file, come IR testuale oppure come bitcode
+// (che gli strumenti LLVM caricano molto più rapidamente del testo)
+int driver::emit_ir(const std::string& f, bool bitcode) {
+  std::error_code EC;
+  raw_fd_ostream dest(f, EC, bitcode ? sys::fs::OF_None : sys::fs::OF_Text);
+  if (EC) {
+    std::cerr << "Impossibile aprire " << f << ": " << EC.message() << std::endl;
+    return 1;
+  }
+  TimeRecord start = TimeRecord::getCurrentTime(true);
+  if (bitcode)
+    WriteBitcodeToFile(*module, dest);
+  else
+    module->print(dest, nullptr);
+  dest.flush();
+  endphase("emit", start);
+  return 0;
+};
+
+/*************************** Compilation report ***************************/
+// Accumula la durata di una fase (iniziata in start) e registra il picco di memoria
+// residente del processo raggiunto fino al suo termine: il picco è cumulativo e, con
+// -j, comprende le compilazioni degli altri file. Fasi eseguite più volte (es. il
+// parsing di più file nello stesso modulo) vengono sommate
+void driver::endphase(const std::string& name, const TimeRecord& start) {
+  if (!time_report)
+    return;
+  TimeRecord elapsed = TimeRecord::getCurrentTime(false);
+  elapsed -= start;
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  for (auto &p : phases)
+    if (p.name == name) {
+      p.time += elapsed;
+      p.peakrss = usage.ru_maxrss;
+      return;
+    }
+  phases.push_back({name, elapsed, usage.ru_maxrss});
+};
+
+// Implementazione del metodo report: tempi (wall, user, system) e picco di memoria
+// del processo al termine di ciascuna fase, dimensione dell'input e dell'AST, istruzioni IR di ogni funzione
+// prima e dopo l'ottimizzazione. Il formato JSON occupa una sola riga, così che i
+// report di più compilazioni possano essere accodati in un unico file
+void driver::report(raw_ostream& out, bool json) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  if (json) {
+    json::OStream J(out);
+    J.object([&] {
+      J.attribute("file", file);
+      J.attribute("lines", (int64_t)lines);
+      J.attribute("bytes", (int64_t)bytes);
+      J.attribute("ast_nodes", (int64_t)astnodes);
+      J.attribute("process_peak_rss_kb", (int64_t)usage.ru_maxrss);
+      J.attributeArray("phases", [&] {
+        for (auto &p : phases)
+          J.object([&] {
+            J.attribute("name", p.name);
+            J.attribute("wall", p.time.getWallTime());
+            J.attribute("user", p.time.getUserTime());
+            J.attribute("sys", p.time.getSystemTime());
+            J.attribute("process_peak_rss_kb", (int64_t)p.peakrss);
+          });
+      });
+      J.attributeArray("functions", [&] {
+        for (auto &f : instcount)
+          J.object([&] {
+            J.attribute("name", f.first);
+            J.attribute("before", (int64_t)f.second.first);
+            J.attribute("after", (int64_t)f.second.second);
+          });
+      });
+    });
+    out << "\n";
+    return;
+  }
+  out << "===------------------------------------------------------------===\n"
+      << "  kcomp time report: " << file << "\n"
+      << "===------------------------------------------------------------===\n"
+      << "  Righe: " << lines << "  Byte: " << bytes << "  Nodi AST: " << astnodes
+      << "  Picco RSS del processo: " << usage.ru_maxrss << " KiB\n\n"
+      << "    Wall (s)   User (s)    Sys (s)  Picco RSS processo (KiB)  Fase\n";
+  for (auto &p : phases)
+    out << format("  %10.4f %10.4f %10.4f %25ld  %s\n", p.time.getWallTime(),
+                  p.time.getUserTime(), p.time.getSystemTime(), p.peakrss, p.name.c_str());
+  if (!instcount.empty()) {
+    out << "\n   Istr. pre Istr. post  Funzione\n";
+    for (auto &f : instcount)
+      out << format("  %10u %10u  %s\n", f.second.first, f.second.second, f.first.c_str());
+  }
+  out << "\n";
+};
+
+// Simboli del runtime del linguaggio, collegato staticamente in kcomp: non essendo
+// esportati dall'eseguibile, il generatore del processo non li troverebbe e vanno
+// quindi definiti esplicitamente nel JITDylib
+static const std::pair<const char*, void*> RuntimeSymbols[] = {
+  { "__krt_pfor", (void*)&__krt_pfor },   { "__krt_enter", (void*)&__krt_enter },
+  { "__krt_exit", (void*)&__krt_exit },   { "__krt_loop", (void*)&__krt_loop },
+};
+
+static Error defineruntime(orc::LLJIT& J) {
+  orc::SymbolMap Symbols;
+  for (auto &R : RuntimeSymbols)
+    Symbols[J.mangleAndIntern(R.first)] = {orc::ExecutorAddr::fromPtr(R.second),
+                                           JITSymbolFlags::Exported};
+  return J.getMainJITDylib().define(orc::absoluteSymbols(std::move(Symbols)));
+}
+
+// Implementazione del metodo run. Anziché emettere il modulo, lo si esegue con il
+// JIT ORC di LLVM (LLLazyJIT): ogni funzione viene compilata solo alla sua prima
+// chiamata, per cui l'avvio non dipende dalla dimensione del modulo.
+// Gli extern (es. floor, sqrt) vengono risolti nei simboli del processo kcomp stesso
+int driver::run(const std::string& entry, const std::vector<double>& args) {
+  Function *EntryF = module->getFunction(entry);
+  if (!EntryF || EntryF->isDeclaration()) {
+    std::cerr << "Funzione " << entry << " non definita" << std::endl;
+    return 1;
+  }
+  if (EntryF->arg_size() != args.size()) {
+    std::cerr << "Numero di argomenti non corretto per " << entry << std::endl;
+    return 1;
+  }
+  for (auto &Arg : EntryF->args())
+    if (!Arg.getType()->isDoubleTy()) {
+      std::cerr << "I parametri array di " << entry << " non possono essere passati con --args" << std::endl;
+      return 1;
+    }
+
+  // Con la compilazione lazy un simbolo esterno mancante verrebbe scoperto solo alla
+  // chiamata, quando non è più possibile recuperare l'errore: gli extern vengono
+  // quindi cercati subito nel processo host
+  sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+  // Il runtime del linguaggio è collegato in kcomp stesso
+  for (auto &R : RuntimeSymbols)
+    sys::DynamicLibrary::AddSymbol(R.first, R.second);
+  for (auto &F : *module)
+    if (F.isDeclaration() && !F.isIntrinsic() &&
+        !sys::DynamicLibrary::SearchForAddressOfSymbol(F.getName().str())) {
+      std::cerr << "Funzione esterna " << F.getName().str() << " non disponibile" << std::endl;
+      return 1;
+    }
+
+  // La chiamata avviene attraverso una funzione "ponte" senza parametri, generata
+  // qui, che invoca l'entry point con gli argomenti costanti richiesti. In questo
+  // modo il lato C++ non deve conoscere il numero di parametri dell'entry point
+  FunctionType *FT = FunctionType::get(Type::getDoubleTy(*context), false);
+  Function *Wrapper = Function::Create(FT, Function::ExternalLinkage, "__kcomp_entry", *module);
+  builder->SetInsertPoint(BasicBlock::Create(*context, "entry", Wrapper));
+  std::vector<Value *> ArgsV;
+  for (double a : args)
+    ArgsV.push_back(ConstantFP::get(*context, APFloat(a)));
+  builder->CreateRet(builder->CreateCall(EntryF, ArgsV, "calltmp"));
+
+  ExitOnError ExitOnErr("kcomp: ");
+  auto J = ExitOnErr(orc::LLLazyJITBuilder().create());
+  orc::JITDylib &JD = J->getMainJITDylib();
+  JD.addGenerator(ExitOnErr(orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+                    J->getDataLayout().getGlobalPrefix())));
+  ExitOnErr(defineruntime(*J));
+
+  // Il JIT diventa proprietario di modulo e contesto, che il driver non potrà
+  // più utilizzare
+  module->setDataLayout(J->getDataLayout());
+  builder.reset();
+  ExitOnErr(J->addLazyIRModule(orc::ThreadSafeModule(std::move(module), std::move(context))));
+
+  auto Sym = ExitOnErr(J->lookup("__kcomp_entry"));
+  double (*EntryFP)() = Sym.toPtr<double (*)()>();
+  std::cout << EntryFP() << std::endl;
+  return 0;
+};
+
+/*********************** Incremental compilation ***********************/
+// Versione del formato della cache: va incrementata quando cambia l'IR generato
+// per lo stesso sorgente, in modo da invalidare le definizioni memorizzate
+static const char *CacheVersion = "kcomp-cache-2";
+
+std::string driver::digest(StringRef text) const {
+  return toHex(SHA256::hash(arrayRefFromStringRef(text)), true);
+};
+
+// Registra il sorgente di una definizione top-level. Lo scanner conta le colonne
+// in byte, per cui riga e colonna della location identificano un offset nel buffer
+void driver::define(const RootAST* item, const yy::location& loc) {
+  auto offset = [this](const yy::position& p) {
+    return linestarts[std::min<size_t>(p.line, linestarts.size()) - 1] + p.column - 1;
+  };
+  size_t begin = offset(loc.begin), end = offset(loc.end);
+  sources[item] = std::string(buffer + begin, end - begin);
+  // Il codice strumentato contiene la posizione della definizione nel sorgente
+  if (instrument_calls || instrument_loops)
+    sources[item] = file + ":" + std::to_string(loc.begin.line) + "." +
+                    std::to_string(loc.begin.column) + "\n" + sources[item];
+};
+
+// Un elemento che non è una definizione di funzione (extern, variabile globale)
+// viene generato normalmente. La codegen di una definizione dipende, oltre che dal
+// suo sorgente, dalle opzioni, dalle dichiarazioni visibili (numero e tipo dei
+// parametri delle funzioni, dimensione delle variabili globali) e dall'insieme delle
+// funzioni pure; tutto ciò concorre alla chiave. Le funzioni pure effettivamente
+// valutate a tempo di compilazione sono invece registrate nel modulo memorizzato,
+// insieme all'hash del loro sorgente, e verificate al caricamento
+void driver::cachedcodegen(RootAST* item) {
+  FunctionAST *F = dynamic_cast<FunctionAST*>(item);
+  if (!F) {
+    item->codegen(*this);
+    cacheiface += sources[item] + ";";
+    return;
+  }
+  const Symbol *name = F->getName();
+  std::string signature = F->getProto()->signature();
+
+  std::string flags = std::string(CacheVersion) + " -O" + std::to_string(optlevel) +
+                      " -passes=" + passes + " -mcpu=" + cpu +
+                      " -fveclib=" + std::to_string(veclib) + (nobuiltin ? " -fno-builtin" : "") +
+                      (instrument_calls ? " -finstrument=calls" : "") +
+                      (instrument_loops ? " -finstrument=loops " : " ") +
+                      module->getTargetTriple() + " " + module->getDataLayoutStr() + " fmf=";
+  for (bool f : { fmf.allowReassoc(), fmf.noNaNs(), fmf.noInfs(), fmf.noSignedZeros(),
+                  fmf.allowReciprocal(), fmf.allowContract(), fmf.approxFunc() })
+    flags += f ? '1' : '0';
+  std::vector<std::string> pure;
+  for (auto &P : purefuns)
+    pure.push_back(P.first->name.str());
+  std::sort(pure.begin(), pure.end());
+  std::string key = flags + '\0' + cacheiface + '\0';
+  for (auto &P : pure)
+    key += P + " ";
+  key = digest(key + '\0' + sources[item]);
+  cacheiface += "def " + signature + ";";
+
+  // Una definizione è caricata dalla cache se il modulo esiste e le funzioni pure
+  // valutate nella sua codegen non sono cambiate. Una funzione già presente nel
+  // modulo viene invece generata normalmente, che ne segnala la ridefinizione
+  std::string path = cachedir + "/" + key + ".bc";
+  auto Buffer = MemoryBuffer::getFile(path);
+  if (Buffer && !module->getFunction(name->name)) {
+    Expected<std::unique_ptr<Module>> M = parseBitcodeFile((*Buffer)->getMemBufferRef(), *context);
+    if (!M)
+      consumeError(M.takeError());
+    else {
+      bool valid = true;
+      if (NamedMDNode *Deps = (*M)->getNamedMetadata("kcomp.deps")) {
+        for (MDNode *Dep : Deps->operands()) {
+          auto Sym = identifiers.find(cast<MDString>(Dep->getOperand(0))->getString());
+          auto P = Sym == identifiers.end() ? purefuns.end() : purefuns.find(&Sym->second);
+          valid = valid && P != purefuns.end() &&
+                  digest(sources[P->second]) == cast<MDString>(Dep->getOperand(1))->getString();
+        }
+        (*M)->eraseNamedMetadata(Deps);
+      }
+      if (valid) {
+        F->getProto()->codegen(*this);
+        cached.insert(name);
+        pending.push_back({key, {}, {}, std::move(*M)});
+        return;
+      }
+    }
+  }
+
+  // Le funzioni generate dalla codegen della definizione sono la funzione stessa,
+  // che può precedere le altre se già dichiarata, e i corpi dei suoi cicli pfor,
+  // accodati al modulo; le variabili accodate sono i siti di -finstrument=, con le
+  // stringhe del nome e della posizione
+  Function *last = module->empty() ? nullptr : &module->getFunctionList().back();
+  GlobalVariable *lastvar = module->global_empty() ? nullptr : &*std::prev(module->global_end());
+  folded.clear();
+  Function *Fn = F->codegen(*this);
+  if (!Fn)
+    return;
+  cacheentry entry{key, {Fn}, std::vector<const Symbol*>(folded.begin(), folded.end()), nullptr};
+  for (auto I = last ? std::next(last->getIterator()) : module->begin(); I != module->end(); ++I)
+    if (!I->isDeclaration() && &*I != Fn)
+      entry.owned.push_back(&*I);
+  for (auto I = lastvar ? std::next(lastvar->getIterator()) : module->global_begin();
+       I != module->global_end(); ++I)
+    entry.globals.push_back(&*I);
+  pending.push_back(std::move(entry));
+};
+
+// Le definizioni generate vengono spostate ciascuna in un proprio modulo (le altre
+// funzioni e le variabili globali vi sono solo dichiarate), ottimizzate e scritte
+// nella cache; il modulo del driver, che ne conserva le dichiarazioni, viene poi
+// completato collegandovi tutti i moduli delle definizioni, nell'ordine del sorgente
+void driver::cachelink() {
+  // Una funzione di libm è sostituita solo se nessuna definizione la precede: una
+  // definizione successiva a un extern con lo stesso nome non viene generata, per
+  // cui la scelta dipende dalle dichiarazioni precedenti, già parte della chiave
+  lowerbuiltins(*module);
+  for (auto &E : pending) {
+    if (E.module)
+      continue;
+    std::set<const GlobalValue*> owned(E.owned.begin(), E.owned.end());
+    owned.insert(E.globals.begin(), E.globals.end());
+    ValueToValueMapTy VMap;
+    E.module = CloneModule(*module, VMap, [&](const GlobalValue* GV) { return owned.count(GV); });
+    for (auto I = E.module->begin(); I != E.module->end(); ) {
+      Function &Fn = *I++;
+      if (Fn.isDeclaration() && Fn.use_empty())
+        Fn.eraseFromParent();
+    }
+    for (auto I = E.module->global_begin(); I != E.module->global_end(); ) {
+      GlobalVariable &GV = *I++;
+      if (GV.use_empty())
+        GV.eraseFromParent();
+    }
+    TimeRecord start = TimeRecord::getCurrentTime(true);
+    if (optimize(*E.module))
+      cacheerror = true;
+    endphase("optimize", start);
+
+    // La definizione è memorizzata con le sue dipendenze, scrivendo in un file
+    // temporaneo poi rinominato: compilazioni concorrenti (es. -j) che condividono
+    // la cache non leggono mai un file incompleto
+    LLVMContext &C = *context;
+    NamedMDNode *Deps = E.module->getOrInsertNamedMetadata("kcomp.deps");
+    for (const Symbol *D : E.deps)
+      Deps->addOperand(MDNode::get(C, { MDString::get(C, D->name),
+                                        MDString::get(C, digest(sources[purefuns[D]])) }));
+    int fd;
+    SmallString<128> tmp;
+    if (!sys::fs::createUniqueFile(cachedir + "/%%%%%%%%.tmp", fd, tmp)) {
+      raw_fd_ostream out(fd, true);
+      WriteBitcodeToFile(*E.module, out, /*ShouldPreserveUseListOrder=*/true);
+      out.close();
+      if (out.has_error() || sys::fs::rename(tmp, cachedir + "/" + E.key + ".bc")) {
+        out.clear_error();
+        sys::fs::remove(tmp);
+      }
+    }
+    E.module->eraseNamedMetadata(Deps);
+
+    // Nel modulo del driver la definizione torna una dichiarazione, mentre i corpi
+    // dei pfor e le variabili, interni, vengono eliminati (i siti prima delle
+    // stringhe a cui fanno riferimento)
+    for (Function *Fn : E.owned)
+      Fn->dropAllReferences();
+    for (Function *Fn : E.owned)
+      if (Fn->hasLocalLinkage())
+        Fn->eraseFromParent();
+      else
+        Fn->deleteBody();
+    for (auto GV = E.globals.rbegin(); GV != E.globals.rend(); ++GV)
+      (*GV)->eraseFromParent();
+  }
+  for (auto &E : pending)
+    if (Linker::linkModules(*module, std::move(E.module))) {
+      std::cerr << "Impossibile collegare una definizione della cache" << std::endl;
+      cacheerror = true;
+    }
+  pending.clear();
+  cached.clear();
+};
+
+/***************************** Whole program *****************************/
+// Inizia il modulo di un nuovo sorgente: quello corrente, se contiene già delle
+// definizioni o dichiarazioni, viene messo da parte per il collegamento finale.
+// Ogni sorgente ha così un proprio modulo, come nella compilazione separata, e le
+// sue dichiarazioni extern non interferiscono con le definizioni degli altri file
+void driver::beginunit() {
+  if (module->empty() && module->global_empty())
+    return;
+  auto M = std::make_unique<Module>("Kaleidoscope", *context);
+  M->setTargetTriple(module->getTargetTriple());
+  M->setDataLayout(module->getDataLayout());
+  units.push_back(std::move(module));
+  module = std::move(M);
+};
+
+// Implementazione del metodo linkunits. I moduli dei sorgenti vengono collegati nel
+// primo (il linker risolve gli extern con le definizioni degli altri file e unisce
+// le variabili globali comuni), quindi tutte le definizioni tranne gli entry point
+// diventano interne: l'ottimizzatore vede l'intero programma e può espandere inline
+// le chiamate fra file diversi ed eliminare le funzioni non più usate
+int driver::linkunits() {
+  TimeRecord start = TimeRecord::getCurrentTime(true);
+  units.push_back(std::move(module));
+  module = std::move(units.front());
+  for (size_t i = 1; i < units.size(); i++)
+    if (Linker::linkModules(*module, std::move(units[i]))) {
+      std::cerr << "Impossibile collegare i moduli dei sorgenti" << std::endl;
+      units.clear();
+      return 1;
+    }
+  units.clear();
+  std::set<std::string> entries(exports.begin(), exports.end());
+  internalizeModule(*module, [&entries](const GlobalValue& GV) {
+    return entries.count(GV.getName().str()) > 0;
+  });
+  endphase("link", start);
+  return 0;
+};
+
+/*************************** Interactive session ***************************/
+// Errore del JIT: viene segnalato e l'elemento corrente viene abbandonato, ma la
+// sessione prosegue
+static bool failed(Error E) {
+  if (!E)
+    return false;
+  std::cerr << "Errore del JIT: " << toString(std::move(E)) << std::endl;
+  return true;
+}
+
+// Destinazione iniziale dello stub di una funzione dichiarata con extern ma non
+// ancora definita (es. per la ricorsione mutua): la chiamata non ha effetto
+static double undefinedstub() {
+  std::cerr << "Chiamata a una funzione dichiarata ma non ancora definita" << std::endl;
+  return NAN;
+}
+
+// Un elemento è completo quando il testo letto termina con ';' al di fuori di
+// parentesi e blocchi: solo allora viene passato al parser
+static bool complete(const std::string& text) {
+  int depth = 0;
+  char last = 0;
+  for (char c : text) {
+    if (c == '(' || c == '[' || c == '{')
+      depth++;
+    else if (c == ')' || c == ']' || c == '}')
+      depth--;
+    if (!isspace((unsigned char)c))
+      last = c;
+  }
+  return last == ';' && depth <= 0;
+}
+
+// Implementazione del metodo repl. Il JIT (LLJIT, non lazy: ogni elemento viene
+// compilato appena letto) resta attivo per tutta la sessione; i file indicati sulla
+// linea di comando vengono caricati prima di leggere stdin, che può essere il
+// terminale (con prompt) o uno script. Il risultato è 1 se qualche elemento è fallito
+int driver::repl(const std::vector<std::string>& files) {
+  stream_ir = false;
+  cachedir.clear();
+  auto J = orc::LLJITBuilder().create();
+  if (!J) {
+    std::cerr << "JIT non disponibile: " << toString(J.takeError()) << std::endl;
+    return 1;
+  }
+  jit = std::move(*J);
+  stubs = orc::createLocalIndirectStubsManagerBuilder(jit->getTargetTriple())();
+  auto Gen = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+               jit->getDataLayout().getGlobalPrefix());
+  if (!stubs || failed(Gen.takeError()) || failed(defineruntime(*jit)))
+    return 1;
+  jit->getMainJITDylib().addGenerator(std::move(*Gen));
+
+  for (auto &f : files)
+    if (parse(f))
+      replstatus = 1;
+    else
+      codegen();
+
+  bool tty = isatty(0);
+  std::string text, line;
+  if (tty)
+    std::cerr << "ready> ";
+  while (std::getline(std::cin, line)) {
+    text += line + "\n";
+    if (complete(text)) {
+      if (parse_string(std::move(text), "<stdin>"))
+        replstatus = 1;
+      else
+        codegen();
+      text.clear();
+    }
+    if (tty)
+      std::cerr << (text.empty() ? "ready> " : "  ...> ");
+  }
+  // Testo rimasto alla fine dell'input: l'ultimo elemento può non avere il ';'
+  // finale, mentre di un elemento incompleto il parser segnala l'errore
+  if (text.find_first_not_of(" \t\r\n") != std::string::npos) {
+    if (parse_string(text + ";", "<stdin>"))
+      replstatus = 1;
+    else
+      codegen();
+  }
+  if (tty)
+    std::cerr << std::endl;
+  return replstatus;
+};
+
+// Codegen di un elemento top-level nella sessione. Il modulo dell'elemento, con un
+// proprio contesto, contiene le dichiarazioni delle funzioni e delle variabili
+// globali definite in precedenza, in modo che la codegen le trovi come in un
+// unico modulo; il JIT risolve poi i riferimenti fra moduli per nome
+void driver::replcodegen(RootAST* item) {
+  builder.reset();  // Modulo e builder precedenti appartengono al vecchio contesto
+  module.reset();
+  context = std::make_unique<LLVMContext>();
+  module = std::make_unique<Module>("repl", *context);
+  module->setTargetTriple(jit->getTargetTriple().str());
+  module->setDataLayout(jit->getDataLayout());
+  builder = std::make_unique<IRBuilder<>>(*context);
+  builder->setFastMathFlags(fmf);
+
+  FunctionAST *F = dynamic_cast<FunctionAST*>(item);
+  PrototypeAST *P = F ? F->getProto() : dynamic_cast<PrototypeAST*>(item);
+  std::string name = P ? P->getName()->name.str() : std::get<std::string>(item->getLexVal());
+  std::vector<bool> arrays;
+  for (unsigned i = 0; P && i < P->getArgs().size(); i++)
+    arrays.push_back(P->isArray(i));
+
+  // Una funzione può essere ridefinita, ma con gli stessi parametri: le chiamate
+  // già compilate passano per lo stub con il tipo della prima dichiarazione
+  auto Old = replfuns.find(name);
+  if (P && Old != replfuns.end() && Old->second.arrays != arrays) {
+    std::cerr << "Ridefinizione di " << name << " con parametri diversi" << std::endl;
+    replstatus = 1;
+    return;
+  }
+  Type *DoubleTy = Type::getDoubleTy(*context);
+  for (auto &D : replfuns) {
+    if (D.first == name) // La definizione corrente sostituisce la dichiarazione
+      continue;
+    std::vector<Type*> Params;
+    for (bool a : D.second.arrays)
+      Params.push_back(a ? (Type*)PointerType::getUnqual(*context) : DoubleTy);
+    Function::Create(FunctionType::get(DoubleTy, Params, false), Function::ExternalLinkage,
+                     D.first, *module);
+  }
+  for (auto &G : replglobals) {
+    Type *T = G.second ? (Type*)ArrayType::get(DoubleTy, G.second) : DoubleTy;
+    GlobalVariable *GV = new GlobalVariable(*module, T, false, GlobalValue::ExternalLinkage,
+                                            nullptr, G.first);
+    if (G.second)
+      GV->setAlignment(ArrayAlign);
+  }
+
+  // Extern: un simbolo del processo (es. sqrt) o del runtime viene risolto dal JIT;
+  // per una funzione della sessione non ancora definita si crea subito lo stub, che
+  // la definizione farà poi puntare al corpo, in modo che possa essere chiamata
+  // dalle definizioni precedenti
+  if (P && !F) {
+    if (Old != replfuns.end())
+      return;
+    auto Sym = jit->lookup(name);
+    if (!Sym) {
+      consumeError(Sym.takeError());
+      if (failed(stubs->createStub(name, orc::ExecutorAddr::fromPtr(&undefinedstub),
+                                   JITSymbolFlags::Exported)) ||
+          failed(jit->getMainJITDylib().define(orc::absoluteSymbols(
+                   {{jit->mangleAndIntern(name), stubs->findStub(name, true)}})))) {
+        replstatus = 1;
+        return;
+      }
+    }
+    replfuns[name] = {arrays, 0};
+    return;
+  }
+  // Variabile globale: definita una sola volta, con linkage esterno perché i
+  // moduli successivi vi fanno riferimento
+  if (!F) {
+    if (replglobals.count(name)) {
+      std::cerr << "Variabile globale " << name << " già definita" << std::endl;
+      replstatus = 1;
+      return;
+    }
+    GlobalVariable *GV = cast_or_null<GlobalVariable>(item->codegen(*this));
+    if (!GV) {
+      replstatus = 1;
+      return;
+    }
+    GV->setLinkage(GlobalValue::ExternalLinkage);
+    replglobals[name] = GV->getValueType()->isArrayTy() ? GV->getValueType()->getArrayNumElements() : 0;
+    builder.reset();
+    if (failed(jit->addIRModule(orc::ThreadSafeModule(std::move(module), std::move(context)))))
+      replstatus = 1;
+    return;
+  }
+
+  Function *Fn = F->codegen(*this);
+  bool anon = name == "__anon_expr";
+  unsigned version = Old == replfuns.end() ? 1 : Old->second.version + 1;
+  if (!Fn) {
+    replstatus = 1;
+    return;
+  }
+  if (!anon)
+    Fn->setName(name + "." + std::to_string(version));
+  std::string body = Fn->getName().str();
+  lowerbuiltins(*module);
+  if ((optlevel > 0 || !passes.empty()) && optimize(*module)) {
+    replstatus = 1;
+    return;
+  }
+  builder.reset();
+
+  // Un'espressione viene eseguita e poi rimossa dal JIT insieme al suo modulo
+  if (anon) {
+    orc::ResourceTrackerSP RT = jit->getMainJITDylib().createResourceTracker();
+    if (failed(jit->addIRModule(RT, orc::ThreadSafeModule(std::move(module), std::move(context))))) {
+      replstatus = 1;
+      return;
+    }
+    auto Sym = jit->lookup(body);
+    if (failed(Sym.takeError()))
+      replstatus = 1;
+    else
+      std::cout << Sym->toPtr<double (*)()>()() << std::endl;
+    failed(RT->remove());
+    return;
+  }
+
+  // Una definizione viene compilata subito (lookup del corpo) e lo stub della
+  // funzione, creato alla prima definizione o dall'extern che la precede, viene
+  // fatto puntare al nuovo corpo
+  if (failed(jit->addIRModule(orc::ThreadSafeModule(std::move(module), std::move(context))))) {
+    replstatus = 1;
+    return;
+  }
+  auto Sym = jit->lookup(body);
+  if (failed(Sym.takeError())) {
+    replstatus = 1;
+    return;
+  }
+  if (!stubs->findStub(name, true).getAddress()) {
+    if (failed(stubs->createStub(name, *Sym, JITSymbolFlags::Exported)) ||
+        failed(jit->getMainJITDylib().define(orc::absoluteSymbols(
+                 {{jit->mangleAndIntern(name), stubs->findStub(name, true)}})))) {
+      replstatus = 1;
+      return;
+    }
+  } else if (failed(stubs->updatePointer(name, *Sym))) {
+    replstatus = 1;
+    return;
+  }
+  replfuns[name] = {arrays, version};
+};
+
+/***************************** Instrumentation *****************************/
+// Variabile che descrive un sito strumentato (struct krt_site del runtime): nome
+// della funzione e posizione nel sorgente sono stringhe costanti, il puntatore al
+// record con i contatori viene impostato dal runtime alla prima esecuzione
+static GlobalVariable *InstrSite(driver& drv, StringRef name, const yy::location& loc, char kind) {
+  LLVMContext &C = *drv.context;
+  PointerType *PtrTy = PointerType::getUnqual(C);
+  Type *Int32Ty = Type::getInt32Ty(C);
+  StructType *SiteTy = StructType::get(C, {PtrTy, PtrTy, Int32Ty, PtrTy});
+  std::string pos = (loc.begin.filename ? *loc.begin.filename : std::string("-")) + ":" +
+                    std::to_string(loc.begin.line) + "." + std::to_string(loc.begin.column);
+  Constant *Init = ConstantStruct::get(SiteTy, {
+      drv.builder->CreateGlobalStringPtr(name, "krt.name", 0, drv.module.get()),
+      drv.builder->CreateGlobalStringPtr(pos, "krt.loc", 0, drv.module.get()),
+      ConstantInt::get(Int32Ty, kind), ConstantPointerNull::get(PtrTy)});
+  return new GlobalVariable(*drv.module, SiteTy, false, GlobalValue::PrivateLinkage, Init,
+                            "krt.site");
+}
+
+// Dichiarazione di una funzione del runtime di strumentazione: void f(ptr site[, i64])
+static FunctionCallee InstrRuntime(driver& drv, StringRef name, bool count = false) {
+  std::vector<Type*> Params = { PointerType::getUnqual(*drv.context) };
+  if (count)
+    Params.push_back(Type::getInt64Ty(*drv.context));
+  return drv.module->getOrInsertFunction(
+      name, FunctionType::get(Type::getVoidTy(*drv.context), Params, false));
+}
+
+// Uscita da una funzione strumentata: prima di ogni ret o, se la funzione termina
+// con una chiamata musttail, prima della chiamata, che deve precedere il ret
+static void InstrExits(driver& drv, Function* function, GlobalVariable* Site) {
+  FunctionCallee Exit = InstrRuntime(drv, "__krt_exit");
+  for (BasicBlock &BB : *function) {
+    ReturnInst *Ret = dyn_cast<ReturnInst>(BB.getTerminator());
+    if (!Ret)
+      continue;
+    Instruction *Pos = Ret;
+    if (CallInst *Call = dyn_cast_or_null<CallInst>(Ret->getPrevNode()))
+      if (Call->isMustTailCall())
+        Pos = Call;
+    IRBuilder<> B(Pos);
+    B.CreateCall(Exit, {Site});
+  }
+}
+
 /************************* Sequence tree **************************/
-SeqAST::SeqAST(RootAST* first, RootAST* continuation):
-  first(first), continuation(continuation) {};
+SeqAST::SeqAST(std::vector<RootAST*> items): items(std::move(items)) {};
 
-// La generazione del codice per una sequenza è banale:
-// 	mediante chiamate ricorsive viene generato il codice di first e poi quello di continuation (con gli opportuni controlli di "esistenza")
+// La generazione del codice per una sequenza è banale: viene generato, in ordine,
+// il codice di ciascuna definizione. Il ciclo (anziché una ricorsione per elemento)
+// mantiene costante la profondità dello stack anche con moltissime definizioni
 Value *SeqAST::codegen(driver& drv) {
-  if (first != nullptr) {
-    Value *f = first->codegen(drv);
-  } else {
-    if (continuation == nullptr) return nullptr;
+  // Con l'ottimizzazione abilitata, le chiamate a funzioni pure con argomenti
+  // costanti vengono calcolate a tempo di compilazione (vedi CallExprAST)
+  if (drv.optlevel > 0)
+    analyze(drv);
+  // Nella sessione interattiva ogni elemento ha un proprio modulo nel JIT
+  if (drv.jit) {
+    for (RootAST* item : items)
+      drv.replcodegen(item);
+    return nullptr;
+  }
+  // Con la cache le definizioni invariate vengono caricate anziché generate
+  if (!drv.cachedir.empty()) {
+    for (RootAST* item : items)
+      drv.cachedcodegen(item);
+    drv.cachelink();
+    return nullptr;
   }
-  Value *c = continuation->codegen(drv);
+  for (RootAST* item : items)
+    item->codegen(drv);
   return nullptr;
 };
 
+// Analisi di purezza. Una funzione è pura se non legge né scrive variabili globali
+// e chiama solo funzioni pure (in particolare nessuna funzione esterna). Poiché le
+// funzioni possono essere ricorsive, l'analisi è un punto fisso: si parte
+// assumendo pure tutte le funzioni definite e si eliminano, finché ve ne sono,
+// quelle il cui corpo viola le condizioni rispetto all'insieme corrente
+void SeqAST::analyze(driver& drv) {
+  drv.purefuns.clear();
+  drv.evalbudget = EvalBudget;
+  drv.evalfailures.clear();
+  std::map<const Symbol*, unsigned> defs;
+  for (RootAST* item : items)
+    if (FunctionAST* F = dynamic_cast<FunctionAST*>(item))
+      if (defs[F->getName()]++ == 0)
+        drv.purefuns[F->getName()] = F;
+  // Una funzione definita più volte non viene valutata (la codegen ne rifiuta
+  // comunque le definizioni successive alla prima)
+  for (auto &D : defs)
+    if (D.second > 1)
+      drv.purefuns.erase(D.first);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto F = drv.purefuns.begin(); F != drv.purefuns.end(); )
+      if (!F->second->pure(drv)) {
+        F = drv.purefuns.erase(F);
+        changed = true;
+      } else
+        ++F;
+  }
+};
+
 /********************* Number Expression Tree *********************/
 NumberExprAST::NumberExprAST(double Val): Val(Val) {};
 
@@ -76,17 +1256,26 @@ lexval NumberExprAST::getLexVal() const {
 // Non viene generata un'istruzione; soltanto una costante LLVM IR corrispondente al valore float memorizzato nel nodo
 // La costante verrà utilizzata in altra parte del processo di generazione
 // Si noti che l'uso del contesto garantisce l'unicità della costanti 
+bool NumberExprAST::pure(const driver& drv, std::vector<const Symbol*>& locals) const {
+  return true;
+};
+
+bool NumberExprAST::eval(Evaluator& ev, double& val) const {
+  val = Val;
+  return true;
+};
+
 Value *NumberExprAST::codegen(driver& drv) {  
-  return ConstantFP::get(*context, APFloat(Val)); // pur avendo accesso alle variabili locali, non restituiamo Val perché le costanti devono essere uniche in un dato context
+  return ConstantFP::get(*drv.context, APFloat(Val)); // pur avendo accesso alle variabili locali, non restituiamo Val perché le costanti devono essere uniche in un dato context
   						  // se c'è la constante nel context la tiriamo fuori, altrimenti la costruiamo con una rappresentazione fp di Val (perché il parser potrebbe usare una
   						  // rappresentazione diversa dal llvm) e poi la inseriamo nel context
 };
 
 /******************** Variable Expression Tree ********************/
-VariableExprAST::VariableExprAST(const std::string &Name): Name(Name) {};
+VariableExprAST::VariableExprAST(const Symbol* Name, ExprAST* Index): Name(Name), Index(Index) {};
 
 lexval VariableExprAST::getLexVal() const {
-  lexval lval = Name;
+  lexval lval = Name->name.str();
   return lval;
 };
 
@@ -99,14 +1288,54 @@ lexval VariableExprAST::getLexVal() const {
    	(2) il registro SSA in cui è stato messo il puntatore alla memoria allocata (si ricordi che A è l'istruzione ma è anche il registro, vista la corrispodenza 1-1 fra le due nozioni), 
    	(3) il nome del registro in cui verrà trasferito il valore dalla memoria
 */
+// Le sole variabili ammesse sono quelle locali: il valore di una globale non è
+// noto a tempo di compilazione
+bool VariableExprAST::effects() const {
+  return Index && Index->effects();
+};
+
+// L'interprete non gestisce gli array
+bool VariableExprAST::pure(const driver& drv, std::vector<const Symbol*>& locals) const {
+  return !Index && std::find(locals.begin(), locals.end(), Name) != locals.end();
+};
+
+bool VariableExprAST::eval(Evaluator& ev, double& val) const {
+  if (Index)
+    return false;
+  double* cell = ev.values.lookup(Name);
+  if (!cell)
+    return false;
+  val = *cell;
+  return true;
+};
+
 Value *VariableExprAST::codegen(driver& drv) {
-  if(AllocaInst *A = drv.NamedValues[Name]){
-    return builder->CreateLoad(A->getAllocatedType(), A, Name.c_str());
-  }
-  if(GlobalVariable *GVar = module->getNamedGlobal(Name)){
-    return builder->CreateLoad(GVar->getValueType(), GVar,Name.c_str());
+  Value *Var = LookupVar(drv, Name);
+  if (!Var)
+    return LogErrorV("Variabile "+Name->name.str()+" non definita (Variable)");
+  // Un array può comparire in un'espressione solo indicizzato (o come argomento
+  // di una chiamata, vedi CallExprAST), uno scalare mai
+  Value *Base = ArrayBase(drv, Var, Name->name);
+  if (Index) {
+    if (!Base)
+      return LogErrorV("Variabile "+Name->name.str()+" non è un array");
+    Value *Ptr = ElementPtr(drv, Base, Index);
+    if (!Ptr)
+      return nullptr;
+    return drv.builder->CreateLoad(Type::getDoubleTy(*drv.context), Ptr, Name->name);
   }
-  return LogErrorV("Variabile "+Name+" non definita (Variable)");
+  if (Base)
+    return LogErrorV("L'array "+Name->name.str()+" deve essere indicizzato");
+  return drv.builder->CreateLoad(Type::getDoubleTy(*drv.context), Var, Name->name);
+}
+
+// Gli array sono passati per indirizzo: la variabile non viene letta, se ne
+// restituisce l'indirizzo del primo elemento (nullptr se non è un array)
+Value *VariableExprAST::address(driver& drv) {
+  Value *Var = LookupVar(drv, Name);
+  if (!Var || Index)
+    return nullptr;
+  return ArrayBase(drv, Var, Name->name);
 }
 
 /******************** Logical Expression Tree **********************/
@@ -114,30 +1343,168 @@ LogicalExprAST::LogicalExprAST(std::string Op, ExprAST* LHS, ExprAST* RHS):
   Op(Op), LHS(LHS), RHS(RHS) {};
 
 // gli operatori logici vengono implementati attraverso specifiche istruzioni comprese nel set di LLVM IR
-Value *LogicalExprAST::codegen(driver& drv) {
-  Value *L = LHS->codegen(drv);
+bool LogicalExprAST::effects() const {
+  // nel caso del "not" l'operando destro non esiste
+  if (Op.compare("not") == 0)
+    return LHS->effects();
+  return LHS->effects() || RHS->effects();
+};
+
+bool LogicalExprAST::pure(const driver& drv, std::vector<const Symbol*>& locals) const {
   if (Op.compare("not") == 0)
-    return builder->CreateNot(L, "notres");
+    return LHS->pure(drv, locals);
+  return LHS->pure(drv, locals) && RHS->pure(drv, locals);
+};
+
+// I valori booleani sono rappresentati da 1.0 (vero) e 0.0 (falso); come nella
+// codegen, l'operando destro viene valutato solo se necessario
+bool LogicalExprAST::eval(Evaluator& ev, double& val) const {
+  double L, R;
+  if (!LHS->eval(ev, L))
+    return false;
+  if (Op.compare("not") == 0) {
+    val = L == 0.0;
+    return true;
+  }
+  if (Op.compare("or") == 0 ? L != 0.0 : L == 0.0) {
+    val = L;
+    return true;
+  }
+  if (!RHS->eval(ev, R))
+    return false;
+  val = R;
+  return true;
+};
 
-  // il calcolo dell'espressione destra non avrebbe senso nel caso del "not", per questo viene inserito dopo
-  Value *R = RHS->codegen(drv);  
-  if (!L || !R)
+Value *LogicalExprAST::codegen(driver& drv) {
+  Value *L = LHS->codegen(drv);
+  if (!L)
     return nullptr;
-  if (Op.compare("or") == 0) {
-    return builder->CreateOr(L, R, "orres");
-  } else if (Op.compare("and") == 0) {
-    return builder->CreateAnd(L, R, "andres");
-  } else {
+  if (Op.compare("not") == 0)
+    return drv.builder->CreateNot(L, "notres");
+  if (Op.compare("or") != 0 && Op.compare("and") != 0) {
     std::cout << Op << std::endl;
     return LogErrorV("Operatore logico non supportato");
   }
+  bool isor = Op.compare("or") == 0;
+
+  // Se l'operando destro è privo di effetti (confronti fra variabili e costanti)
+  // valutarlo sempre costa meno di un salto: i due risultati i1 vengono combinati
+  // direttamente, senza introdurre nuovi blocchi
+  if (!RHS->effects()) {
+    Value *R = RHS->codegen(drv);
+    if (!R)
+      return nullptr;
+    if (isor)
+      return drv.builder->CreateOr(L, R, "orres");
+    return drv.builder->CreateAnd(L, R, "andres");
+  }
+
+  // Altrimenti la valutazione è cortocircuitata: l'operando destro (ad esempio una
+  // chiamata di funzione) viene calcolato solo se il sinistro non basta a
+  // determinare il risultato, ovvero se è falso per "or" e vero per "and".
+  // Il risultato è dato da un'istruzione PHI che vale L (true per "or", false
+  // per "and") se si proviene dal blocco dell'operando sinistro, R altrimenti
+  Function *function = drv.builder->GetInsertBlock()->getParent();
+  BasicBlock *LeftBB = drv.builder->GetInsertBlock();
+  BasicBlock *RightBB = BasicBlock::Create(*drv.context, isor ? "orrhs" : "andrhs", function);
+  BasicBlock *MergeBB = BasicBlock::Create(*drv.context, isor ? "orend" : "andend");
+  if (isor)
+    drv.builder->CreateCondBr(L, MergeBB, RightBB);
+  else
+    drv.builder->CreateCondBr(L, RightBB, MergeBB);
+
+  drv.builder->SetInsertPoint(RightBB);
+  Value *R = RHS->codegen(drv);
+  if (!R)
+    return nullptr;
+  drv.builder->CreateBr(MergeBB);
+  // Come per IfExprAST, il codice dell'operando destro può aver creato nuovi
+  // blocchi: il predecessore di MergeBB è il blocco corrente, non RightBB
+  RightBB = drv.builder->GetInsertBlock();
+
+  function->insert(function->end(), MergeBB);
+  drv.builder->SetInsertPoint(MergeBB);
+  PHINode *PN = drv.builder->CreatePHI(Type::getInt1Ty(*drv.context), 2, isor ? "orres" : "andres");
+  PN->addIncoming(ConstantInt::getBool(*drv.context, isor), LeftBB);
+  PN->addIncoming(R, RightBB);
+  return PN;
 };
 
 /******************** Binary Expression Tree **********************/
 BinaryExprAST::BinaryExprAST(char Op, ExprAST* LHS, ExprAST* RHS):
-  Op(Op), LHS(LHS), RHS(RHS) {};
+  Op(Op), LHS(LHS), RHS(RHS), Accum(nullptr) {};
+
+bool BinaryExprAST::effects() const {
+  return LHS->effects() || RHS->effects();
+};
+
+bool BinaryExprAST::pure(const driver& drv, std::vector<const Symbol*>& locals) const {
+  return LHS->pure(drv, locals) && RHS->pure(drv, locals);
+};
+
+// Stessa semantica delle istruzioni generate: aritmetica IEEE in doppia precisione
+// e confronti "unordered" (veri se uno degli operandi è NaN)
+bool BinaryExprAST::eval(Evaluator& ev, double& val) const {
+  double L, R;
+  if (!LHS->eval(ev, L) || !RHS->eval(ev, R))
+    return false;
+  switch (Op) {
+  case '+':
+    val = L + R;
+    return true;
+  case '-':
+    val = L - R;
+    return true;
+  case '*':
+    val = L * R;
+    return true;
+  case '/':
+    val = L / R;
+    return true;
+  case '<':
+    val = !(L >= R);
+    return true;
+  case '=':
+    val = L == R || std::isnan(L) || std::isnan(R);
+    return true;
+  default:
+    return false;
+  }
+};
+
+// Una somma o un prodotto in posizione di coda con una chiamata ricorsiva come
+// operando, f(x) = a*f(y), equivale a calcolare f(y) dopo aver moltiplicato
+// l'accumulatore per a: la trasformazione riassocia le operazioni, per cui è
+// ammessa solo con -ffast-math. Se la chiamata è il primo operando, l'altro viene
+// valutato prima degli argomenti, e dunque nessuno dei due può avere effetti
+void BinaryExprAST::tail(TailRec& info) {
+  if (!info.accumulate || (Op != '+' && Op != '*') || (info.op && info.op != Op))
+    return;
+  CallExprAST *L = dynamic_cast<CallExprAST*>(LHS);
+  CallExprAST *R = dynamic_cast<CallExprAST*>(RHS);
+  if (R && R->getCallee() == info.fn)
+    Accum = R;
+  else if (L && L->getCallee() == info.fn && !L->argeffects() && !RHS->effects())
+    Accum = L;
+  else
+    return;
+  info.op = Op;
+  Accum->tail(info);
+};
 
 Value *BinaryExprAST::codegen(driver& drv) {
+  if (Accum) {
+    Value *V = (Accum == LHS ? RHS : LHS)->codegen(drv);
+    if (!V)
+      return nullptr;
+    Type *DoubleTy = Type::getDoubleTy(*drv.context);
+    Value *Acc = drv.builder->CreateLoad(DoubleTy, drv.tailrec.acc, "acc");
+    drv.builder->CreateStore(Op == '+' ? drv.builder->CreateFAdd(Acc, V, "accres")
+                                       : drv.builder->CreateFMul(Acc, V, "accres"),
+                             drv.tailrec.acc);
+    return Accum->codegen(drv);
+  }
   Value *L = LHS->codegen(drv);
   Value *R = RHS->codegen(drv);
 
@@ -145,17 +1512,24 @@ Value *BinaryExprAST::codegen(driver& drv) {
      return nullptr;
   switch (Op) {
   case '+':
-    return builder->CreateFAdd(L,R,"addres");
+    return drv.builder->CreateFAdd(L,R,"addres");
   case '-':
-    return builder->CreateFSub(L,R,"subres");
+    return drv.builder->CreateFSub(L,R,"subres");
   case '*':
-    return builder->CreateFMul(L,R,"mulres");
+    return drv.builder->CreateFMul(L,R,"mulres");
   case '/':
-    return builder->CreateFDiv(L,R,"addres");
+    return drv.builder->CreateFDiv(L,R,"addres");
+  // Se i NaN sono esclusi (-fno-nans, -ffast-math) i confronti "unordered" e
+  // "ordered" coincidono: si usano questi ultimi, che corrispondono direttamente
+  // alle istruzioni di confronto della macchina e si prestano alla vettorizzazione
   case '<':
-    return builder->CreateFCmpULT(L,R,"lttest");
+    if (drv.fmf.noNaNs())
+      return drv.builder->CreateFCmpOLT(L,R,"lttest");
+    return drv.builder->CreateFCmpULT(L,R,"lttest");
   case '=':
-    return builder->CreateFCmpUEQ(L,R,"eqtest");
+    if (drv.fmf.noNaNs())
+      return drv.builder->CreateFCmpOEQ(L,R,"eqtest");
+    return drv.builder->CreateFCmpUEQ(L,R,"eqtest");
   default:  
     std::cout << Op << std::endl;
     return LogErrorV("Operatore binario non supportato");
@@ -163,43 +1537,148 @@ Value *BinaryExprAST::codegen(driver& drv) {
 };
 
 /********************* Call Expression Tree ***********************/
-CallExprAST::CallExprAST(std::string Callee, std::vector<ExprAST*> Args):
-  Callee(Callee),  Args(std::move(Args)) {};
+CallExprAST::CallExprAST(const Symbol* Callee, std::vector<ExprAST*> Args):
+  Callee(Callee),  Args(std::move(Args)), Tail(false) {};
 
 lexval CallExprAST::getLexVal() const {
-  lexval lval = Callee;
+  lexval lval = Callee->name.str();
   return lval;
 };
 
+const Symbol* CallExprAST::getCallee() const {
+  return Callee;
+};
+
+bool CallExprAST::argeffects() const {
+  return std::any_of(Args.begin(), Args.end(), [](ExprAST* A) { return A->effects(); });
+};
+
+void CallExprAST::tail(TailRec& info) {
+  Tail = true;
+  if (Callee == info.fn)
+    info.recursive = true;
+};
+
+bool CallExprAST::pure(const driver& drv, std::vector<const Symbol*>& locals) const {
+  if (!drv.purefuns.count(Callee))
+    return false;
+  for (auto arg : Args)
+    if (!arg->pure(drv, locals))
+      return false;
+  return true;
+};
+
+bool CallExprAST::eval(Evaluator& ev, double& val) const {
+  std::vector<double> ArgsV;
+  for (auto arg : Args) {
+    ArgsV.push_back(0.0);
+    if (!arg->eval(ev, ArgsV.back()))
+      return false;
+  }
+  return ev.call(Callee, ArgsV, val);
+};
+
 Value* CallExprAST::codegen(driver& drv) {
   // La generazione del codice corrispondente ad una chiamata di funzione inizia cercando nel modulo corrente (l'unico, nel nostro caso) 
   // una funzione il cui nome coincide con il nome memorizzato nel nodo dell'AST
   // Se la funzione non viene trovata (e dunque non è stata precedentemente definita) viene generato un errore
-  Function *CalleeF = module->getFunction(Callee);
+  Function *CalleeF = drv.module->getFunction(Callee->name);
   if (!CalleeF)
      return LogErrorV("Funzione non definita");
   // Il secondo controllo è che la funzione recuperata abbia tanti parametri quanti sono gi argomenti previsti nel nodo AST
   if (CalleeF->arg_size() != Args.size())
      return LogErrorV("Numero di argomenti non corretto");
+  // Se la funzione (definita in questo sorgente) è pura e gli argomenti sono
+  // costanti, la chiamata viene eseguita dall'interprete e sostituita dal suo
+  // risultato. Gli argomenti sono valutati senza variabili visibili, per cui
+  // l'interprete fallisce se ne dipendono. Le funzioni caricate dalla cache sono
+  // solo dichiarate, ma il loro AST è noto; le funzioni valutate diventano
+  // dipendenze della definizione corrente nella cache
+  if (drv.purefuns.count(Callee) && (!CalleeF->isDeclaration() || drv.cached.count(Callee)) &&
+      drv.evalbudget) {
+    Evaluator ev(drv.purefuns, std::min(EvalSteps, drv.evalbudget), drv.evalfailures);
+    double val;
+    bool ok = eval(ev, val);
+    drv.evalbudget -= std::min(EvalSteps, drv.evalbudget) - ev.steps;
+    drv.folded.insert(ev.used.begin(), ev.used.end());
+    if (ok)
+      return ConstantFP::get(*drv.context, APFloat(val));
+  }
   // Passato con successo anche il secondo controllo, viene predisposta
   // ricorsivamente la valutazione degli argomenti presenti nella chiamata 
   // (si ricordi che gli argomenti possono essere espressioni arbitarie)
   // I risultati delle valutazioni degli argomenti (registri SSA, come sempre)
   // vengono inseriti in un vettore, dove "se li aspetta" il metodo CreateCall
   // del builder, che viene chiamato subito dopo per la generazione dell'istruzione IR di chiamata
+  // Ad un parametro array va passato il nome di un array, di cui si passa l'indirizzo
   std::vector<Value *> ArgsV;
-  for (auto arg : Args) {
-     ArgsV.push_back(arg->codegen(drv));
+  for (unsigned i = 0; i < Args.size(); i++) {
+     if (CalleeF->getArg(i)->getType()->isPointerTy()) {
+        VariableExprAST *Var = dynamic_cast<VariableExprAST*>(Args[i]);
+        ArgsV.push_back(Var ? Var->address(drv) : nullptr);
+        if (!ArgsV.back())
+           return LogErrorV("L'argomento " + std::to_string(i+1) + " di " +
+                            Callee->name.str() + " deve essere un array");
+        continue;
+     }
+     ArgsV.push_back(Args[i]->codegen(drv));
      if (!ArgsV.back())
         return nullptr;
   }
-  return builder->CreateCall(CalleeF, ArgsV, "calltmp");
+  // Una chiamata in posizione di coda non deve ricevere array locali (alloca del
+  // chiamante): la memoria del chiamante non sopravvive ad una chiamata di coda né,
+  // se la ricorsione diventa un ciclo, alla reinizializzazione dell'iterazione successiva
+  if (Tail && std::none_of(ArgsV.begin(), ArgsV.end(), [](Value* V) { return isa<AllocaInst>(V); })) {
+     Type *DoubleTy = Type::getDoubleTy(*drv.context);
+     // Chiamata ricorsiva: gli argomenti, già tutti calcolati, diventano i nuovi
+     // valori dei parametri e si salta all'inizio del corpo. Il blocco corrente
+     // è terminato e il valore restituito non viene usato
+     if (Callee == drv.tailrec.fn && drv.tailrec.loop) {
+        for (unsigned i = 0; i < ArgsV.size(); i++)
+           drv.builder->CreateStore(ArgsV[i], drv.tailrec.params[i]);
+        drv.builder->CreateBr(drv.tailrec.loop);
+        return PoisonValue::get(DoubleTy);
+     }
+     CallInst *Call = drv.builder->CreateCall(CalleeF, ArgsV, "calltmp");
+     // Se la funzione chiamata ha lo stesso prototipo del chiamante (e il risultato
+     // non va combinato con l'accumulatore) la chiamata di coda è garantita anche
+     // senza ottimizzazioni: musttail, seguita immediatamente dal return
+     Function *function = drv.builder->GetInsertBlock()->getParent();
+     if (!drv.tailrec.op && CalleeF->getFunctionType() == function->getFunctionType()) {
+        Call->setTailCallKind(CallInst::TCK_MustTail);
+        drv.builder->CreateRet(Call);
+        return PoisonValue::get(DoubleTy);
+     }
+     Call->setTailCall();
+     return Call;
+  }
+  return drv.builder->CreateCall(CalleeF, ArgsV, "calltmp");
 }
 
 /************************* If Expression Tree *************************/
 IfExprAST::IfExprAST(ExprAST* Cond, ExprAST* TrueExp, ExprAST* FalseExp):
    Cond(Cond), TrueExp(TrueExp), FalseExp(FalseExp) {};
    
+bool IfExprAST::effects() const {
+  return Cond->effects() || TrueExp->effects() || FalseExp->effects();
+};
+
+bool IfExprAST::pure(const driver& drv, std::vector<const Symbol*>& locals) const {
+  return Cond->pure(drv, locals) && TrueExp->pure(drv, locals) && FalseExp->pure(drv, locals);
+};
+
+bool IfExprAST::eval(Evaluator& ev, double& val) const {
+  double C;
+  if (!Cond->eval(ev, C))
+    return false;
+  return C != 0.0 ? TrueExp->eval(ev, val) : FalseExp->eval(ev, val);
+};
+
+void IfExprAST::tail(TailRec& info) {
+  TrueExp->tail(info);
+  FalseExp->tail(info);
+};
+
 Value* IfExprAST::codegen(driver& drv) {
     // Viene dapprima generato il codice per valutare la condizione, che memorizza il risultato
     // (di tipo i1, dunque booleano) nel registro SSA che viene "memorizzato" in CondV. 
@@ -210,27 +1689,31 @@ Value* IfExprAST::codegen(driver& drv) {
     // Ora bisogna generare l'istruzione di salto condizionato, ma prima
     // vanno creati i corrispondenti basic block nella funzione attuale
     // (ovvero la funzione di cui fa parte il corrente blocco di inserimento)
-    Function *function = builder->GetInsertBlock()->getParent();
-    BasicBlock *TrueBB =  BasicBlock::Create(*context, "trueexp", function);
+    Function *function = drv.builder->GetInsertBlock()->getParent();
+    BasicBlock *TrueBB =  BasicBlock::Create(*drv.context, "trueexp", function);
     // Il blocco TrueBB viene inserito nella funzione dopo il blocco corrente
-    BasicBlock *FalseBB = BasicBlock::Create(*context, "falseexp");
-    BasicBlock *MergeBB = BasicBlock::Create(*context, "endcond");
+    BasicBlock *FalseBB = BasicBlock::Create(*drv.context, "falseexp");
+    BasicBlock *MergeBB = BasicBlock::Create(*drv.context, "endcond");
     // Gli altri due blocchi non vengono ancora inseriti perché le istruzioni
     // previste nel "ramo" true del condizionale potrebbe dare luogo alla creazione
     // di altri blocchi, che naturalmente andrebbero inseriti prima di FalseBB
     // (blocchi "floating" di cui ho solo un'etichetta e non un punto fissato nel programma)
     
     // Ora possiamo crere l'istruzione di salto condizionato sul risultato del condizionale
-    builder->CreateCondBr(CondV, TrueBB, FalseBB);
+    drv.builder->CreateCondBr(CondV, TrueBB, FalseBB);
     
     // "Posizioniamo" il builder all'inizio del blocco true, 
     // generiamo ricorsivamente il codice da eseguire in caso di condizione vera e, 
     // in chiusura di blocco, generiamo il salto incondizionato al blocco merge
-    builder->SetInsertPoint(TrueBB);
+    drv.builder->SetInsertPoint(TrueBB);
     Value *TrueV = TrueExp->codegen(drv);
     if (!TrueV)
        return nullptr;
-    builder->CreateBr(MergeBB);
+    // Un ramo in posizione di coda può terminare con una chiamata ricorsiva (salto
+    // all'inizio della funzione) o con un return: in tal caso non confluisce in MergeBB
+    bool TrueLive = !drv.builder->GetInsertBlock()->getTerminator();
+    if (TrueLive)
+       drv.builder->CreateBr(MergeBB);
     
     // Come già ricordato, la chiamata di codegen in TrueExp potrebbe aver inserito 
     // altri blocchi (nel caso in cui la parte trueexp sia a sua volta un condizionale).
@@ -240,28 +1723,35 @@ Value* IfExprAST::codegen(driver& drv) {
     // il salto perché tale informazione verrà utilizzata da un'istruzione PHI.
     // Nel caso in cui non sia stato inserito alcun nuovo blocco, la seguente
     // istruzione corrisponde ad una NO-OP
-    TrueBB = builder->GetInsertBlock();
+    TrueBB = drv.builder->GetInsertBlock();
     function->insert(function->end(), FalseBB);
     
     // "Posizioniamo" il builder all'inizio del blocco false, 
     // generiamo ricorsivamente il codice da eseguire in caso di condizione falsa e, 
     // in chiusura di blocco, generiamo il saldo incondizionato al blocco merge
-    builder->SetInsertPoint(FalseBB);
+    drv.builder->SetInsertPoint(FalseBB);
     
     Value *FalseV = FalseExp->codegen(drv);
     if (!FalseV)
        return nullptr;
-    builder->CreateBr(MergeBB);
+    bool FalseLive = !drv.builder->GetInsertBlock()->getTerminator();
+    if (FalseLive)
+       drv.builder->CreateBr(MergeBB);
     
     // Esattamente per la ragione spiegata sopra (ovvero il possibile inserimento
     // di nuovi blocchi da parte della chiamata di codegen in FalseExp), andiamo ora
     // a recuperare il blocco corrente 
-    FalseBB = builder->GetInsertBlock();
+    FalseBB = drv.builder->GetInsertBlock();
+    // Se nessuno dei due rami confluisce, il costrutto non ha un valore
+    if (!TrueLive && !FalseLive) {
+       delete MergeBB;
+       return PoisonValue::get(Type::getDoubleTy(*drv.context));
+    }
     function->insert(function->end(), MergeBB);
     
     // Andiamo dunque a generare il codice per la parte dove i due "flussi"
     // di esecuzione si riuniscono. Impostiamo correttamente il builder
-    builder->SetInsertPoint(MergeBB);
+    drv.builder->SetInsertPoint(MergeBB);
   
     // Il codice di riunione dei flussi è una "semplice" istruzione PHI: 
     // a seconda del blocco da cui arriva il flusso, TrueBB o FalseBB, il valore
@@ -272,21 +1762,74 @@ Value* IfExprAST::codegen(driver& drv) {
     // 1) Dapprima si crea il nodo PHI specificando quanti sono i possibili nodi sorgente
     // 2) Per ogni possibile nodo sorgente, viene poi inserita l'etichetta e il registro
     //    SSA da cui prelevare il valore 
-    PHINode *PN = builder->CreatePHI(Type::getDoubleTy(*context), 2, "condval"); // specifico il tipo restituito dai blocci ed il numero di flussi che si riuniscono
+    PHINode *PN = drv.builder->CreatePHI(Type::getDoubleTy(*drv.context), 2, "condval"); // specifico il tipo restituito dai blocci ed il numero di flussi che si riuniscono
     // il metodo addIncoming considera valore:provenienza, in modo tale che il risultato venga preso...
-    PN->addIncoming(TrueV, TrueBB); // ...dal registro SSA TrueV se si proviene dal blocco TrueBB
-    PN->addIncoming(FalseV, FalseBB); // ...dal registro SSA FalseV se si proviene dal blocco FalseBB
+    if (TrueLive)
+      PN->addIncoming(TrueV, TrueBB); // ...dal registro SSA TrueV se si proviene dal blocco TrueBB
+    if (FalseLive)
+      PN->addIncoming(FalseV, FalseBB); // ...dal registro SSA FalseV se si proviene dal blocco FalseBB
     return PN; // ritorno il risultato
 };
 
 /********************** For Expression Tree *********************/
-ForExprAST::ForExprAST(RootAST* StartExp, ExprAST* Cond, AssignmentAST* StepExp, ExprAST* BlockExp):
-        StartExp(StartExp), Cond(Cond), StepExp(StepExp), BlockExp(BlockExp) {};
+ForExprAST::ForExprAST(RootAST* StartExp, ExprAST* Cond, AssignmentAST* StepExp, ExprAST* BlockExp,
+                       const yy::location& Loc):
+        StartExp(StartExp), Cond(Cond), StepExp(StepExp), BlockExp(BlockExp), Loc(Loc) {};
   
+// La variabile di controllo è locale al ciclo; se l'inizializzazione è un
+// assegnamento, questo deve riferirsi ad una variabile locale già visibile
+bool ForExprAST::pure(const driver& drv, std::vector<const Symbol*>& locals) const {
+  size_t scope = locals.size();
+  bool ok;
+  if (VarBindingAST* Binding = dynamic_cast<VarBindingAST*>(StartExp))
+    ok = Binding->pure(drv, locals);
+  else {
+    AssignmentAST* Assign = dynamic_cast<AssignmentAST*>(StartExp);
+    ok = Assign->pure(drv, locals);
+    locals.push_back(Assign->getName());
+  }
+  ok = ok && Cond->pure(drv, locals) && BlockExp->pure(drv, locals) &&
+       (!StepExp || StepExp->pure(drv, locals));
+  locals.resize(scope);
+  return ok;
+};
+
+bool ForExprAST::eval(Evaluator& ev, double& val) const {
+  size_t scope = ev.values.enter();
+  bool ok;
+  if (VarBindingAST* Binding = dynamic_cast<VarBindingAST*>(StartExp))
+    ok = Binding->eval(ev);
+  else {
+    AssignmentAST* Assign = dynamic_cast<AssignmentAST*>(StartExp);
+    double init;
+    ok = Assign->eval(ev, init);
+    if (ok)
+      ev.bind(Assign->getName(), init);
+  }
+  // Stessa struttura del codice generato: test, corpo e incremento, nuovo test.
+  // Ogni iterazione consuma un passo del budget dell'interprete
+  double C, tmp;
+  ok = ok && Cond->eval(ev, C);
+  while (ok && C != 0.0) {
+    if (!ev.steps) {
+      ok = false;
+      break;
+    }
+    ev.steps--;
+    ok = BlockExp->eval(ev, tmp) && (!StepExp || StepExp->eval(ev, tmp)) &&
+         Cond->eval(ev, C);
+  }
+  ev.values.leave(scope);
+  val = 0.0;
+  return ok;
+};
+
 Value* ForExprAST::codegen(driver& drv){
-    Function *function = builder->GetInsertBlock()->getParent();
-    AllocaInst* AllocaTmp;
+    Function *function = drv.builder->GetInsertBlock()->getParent();
     AllocaInst *Alloca;
+    // La variabile di controllo appartiene ad uno scope proprio del ciclo, che
+    // oscura un'eventuale variabile omonima esterna fino alla fine del for
+    size_t scope = drv.NamedValues.enter();
     VarBindingAST* SubClass = dynamic_cast<VarBindingAST*>(StartExp);
     
     if(SubClass){
@@ -294,28 +1837,34 @@ Value* ForExprAST::codegen(driver& drv){
       Alloca = SubClass->codegen(drv);
       if (!Alloca)
         return nullptr;
-      // Viene temporaneamente rimossa la precedente istruzione di allocazione
-      // della stessa variabile (nome) e inserita quella corrente
-      AllocaTmp = drv.NamedValues[SubClass->getName()];
-      drv.NamedValues[SubClass->getName()] = Alloca;
+      // e la registro nello scope del ciclo
+      drv.NamedValues.bind(SubClass->getName(), Alloca);
     } else { // se il cast non è andato a buon fine l'oggetto Subclass non sarà definito come VarBindingAST, bensì come AssignmentAST
       AssignmentAST* SubClass = dynamic_cast<AssignmentAST*>(StartExp);
 
       // similmente al caso precedente, creo un'istruzione di allocazione iniziale...
-      Alloca = CreateEntryBlockAlloca(function, SubClass->getName());
+      Alloca = CreateEntryBlockAlloca(function, SubClass->getName()->name);
       Value *Var = SubClass->codegen(drv);
       if (!Var)
         return nullptr;
-      builder->CreateStore(Var, Alloca); // in questo caso devo anche riservare lo spazio in memoria
+      drv.builder->CreateStore(Var, Alloca); // in questo caso devo anche riservare lo spazio in memoria
+
+      // ...e registro nello scope del ciclo l'istruzione di allocazione attuale della variabile nell'espressione di inizializzazione
+      drv.NamedValues.bind(SubClass->getName(), Alloca);
+    }
 
-      // ...e salvo nella symbol table l'istruzione di allocazione attuale della variabile nell'espressione di inizializzazione
-      AllocaTmp = drv.NamedValues[SubClass->getName()];
-      drv.NamedValues[SubClass->getName()] = Alloca;
+    // con -finstrument=loops le iterazioni vengono contate e, all'uscita dal
+    // ciclo, il loro numero viene passato al runtime
+    Type *Int64Ty = Type::getInt64Ty(*drv.context);
+    AllocaInst *Trips = nullptr;
+    if (drv.instrument_loops) {
+      Trips = CreateEntryBlockAlloca(function, "trips", Int64Ty);
+      drv.builder->CreateStore(drv.builder->getInt64(0), Trips);
     }
 
     // inserisco il LoopBB nella funzione, subito dopo il blocco corrente
-    BasicBlock *LoopBB = BasicBlock::Create(*context, "loop", function);
-    BasicBlock *AfterBB = BasicBlock::Create(*context, "afterloop");
+    BasicBlock *LoopBB = BasicBlock::Create(*drv.context, "loop", function);
+    BasicBlock *AfterBB = BasicBlock::Create(*drv.context, "afterloop");
     // AfterBB viene fissato successivamente nel programma, in quanto LoopBB potrebbe dare luogo alla creazione di altri blocchi
 
     // "calcolo" la condizione...
@@ -324,14 +1873,17 @@ Value* ForExprAST::codegen(driver& drv){
       return nullptr;
 
     // ...e ne valuto il risultato
-    builder->CreateCondBr(EndV, LoopBB, AfterBB);
+    drv.builder->CreateCondBr(EndV, LoopBB, AfterBB);
 
     // posiziono il builder all'inizio del LoopBB e definisco il codice da eseguire al suo interno
-    builder->SetInsertPoint(LoopBB);
+    drv.builder->SetInsertPoint(LoopBB);
 
     // calcolo il body del loop  
     if (!BlockExp->codegen(drv))
       return nullptr;
+    if (Trips)
+      drv.builder->CreateStore(drv.builder->CreateAdd(drv.builder->CreateLoad(Int64Ty, Trips, "trips"),
+                                                      drv.builder->getInt64(1)), Trips);
 
     // calcolo l'istruzione di incremento
     Value *StepVal = nullptr;
@@ -341,7 +1893,7 @@ Value* ForExprAST::codegen(driver& drv){
         return nullptr;
     } else {
       // se non specificato incremento di 1.0
-      StepVal = ConstantFP::get(*context, APFloat(1.0));
+      StepVal = ConstantFP::get(*drv.context, APFloat(1.0));
     }
 
     EndV = Cond->codegen(drv);
@@ -349,32 +1901,232 @@ Value* ForExprAST::codegen(driver& drv){
       return nullptr;
 
     // terminate le operazioni nel body, valuto nuovamente la condizione per decidere se iterare o meno
-    builder->CreateCondBr(EndV, LoopBB, AfterBB);
+    drv.builder->CreateCondBr(EndV, LoopBB, AfterBB);
 
     // recupero il blocco corrente (LoopBB) ed inserisco AfterBB subito dopo
-    LoopBB = builder->GetInsertBlock();
+    LoopBB = drv.builder->GetInsertBlock();
     function->insert(function->end(), AfterBB);
 
     // definisco il codice da eseguire all'interno di AfterBB
-    builder->SetInsertPoint(AfterBB);
+    drv.builder->SetInsertPoint(AfterBB);
+    if (Trips)
+      drv.builder->CreateCall(InstrRuntime(drv, "__krt_loop", true),
+                              {InstrSite(drv, function->getName(), Loc, 'l'),
+                               drv.builder->CreateLoad(Int64Ty, Trips, "trips")});
 
-    // inizialmente, una volta calcolata l'espressione di inizializzazione, aggiorno la symbol table (e gli scope delle variabili)
-    // il body del for, quindi, lavora sulla symbol table appena modificata
+    // la chiusura dello scope del ciclo rende nuovamente visibile l'eventuale
+    // variabile esterna omonima della variabile di controllo
+    drv.NamedValues.leave(scope);
 
-    // questo permette di gestire correttamente gli scope di variabili "interne ed esterne" al blocco di codice del for
-    if (AllocaTmp)
-      drv.NamedValues[SubClass->getName()] = AllocaTmp; // se precedentemente erano già state definite ripristino lo scope
-    else
-      drv.NamedValues.erase(SubClass->getName()); // se sono state definite internamente, fuori non saranno visibili
-
-    return Constant::getNullValue(Type::getDoubleTy(*context));
+    return Constant::getNullValue(Type::getDoubleTy(*drv.context));
 };
 
 
+/********************** PFor Expression Tree *********************/
+PForExprAST::PForExprAST(const Symbol* Var, ExprAST* Start, ExprAST* End, ExprAST* Body,
+                         char RedOp, const Symbol* RedVar):
+  Var(Var), Start(Start), End(End), Body(Body), RedOp(RedOp), RedVar(RedVar) {};
+
+// Il ciclo pfor (var i = a; i < b; ++i) S esegue S per ognuno dei ceil(b-a) valori
+// di i a partire da a, in un ordine qualsiasi e su più thread. Il corpo viene
+// estratto in una funzione
+//     void body(ptr env, i64 begin, i64 end, ptr partial)
+// che esegue le iterazioni di indice [begin, end); il runtime (__krt_pfor) divide
+// l'intervallo delle iterazioni fra i thread. env è un vettore di puntatori: il primo
+// al valore iniziale a, i successivi alle variabili locali visibili nel punto del
+// ciclo. Nel corpo gli scalari catturati sono copie private (assegnarli è un errore,
+// perché le iterazioni sarebbero in conflitto), gli array sono condivisi.
+// La variabile di riduzione è privata di ogni thread e parte dall'elemento neutro;
+// al termine i valori parziali, combinati dal runtime, vengono accumulati in essa
+Value* PForExprAST::codegen(driver& drv) {
+  Function *function = drv.builder->GetInsertBlock()->getParent();
+  Type *DoubleTy = Type::getDoubleTy(*drv.context);
+  Type *PtrTy = PointerType::getUnqual(*drv.context);
+  Type *Int64Ty = Type::getInt64Ty(*drv.context);
+
+  AllocaInst *RedAlloca = nullptr;
+  if (RedOp) {
+    RedAlloca = drv.NamedValues.lookup(RedVar);
+    if (!RedAlloca || !RedAlloca->getAllocatedType()->isDoubleTy())
+      return LogErrorV("La variabile di riduzione " + RedVar->name.str() +
+                       " deve essere una variabile locale scalare");
+  }
+
+  // Valore iniziale e numero di iterazioni, calcolati una sola volta
+  Value *Lo = Start->codegen(drv);
+  if (!Lo)
+    return nullptr;
+  Value *Hi = End->codegen(drv);
+  if (!Hi)
+    return nullptr;
+  Value *Count = drv.builder->CreateCall(
+      Intrinsic::getDeclaration(drv.module.get(), Intrinsic::ceil, {DoubleTy}),
+      {drv.builder->CreateFSub(Hi, Lo, "range")}, "count");
+  Count = drv.builder->CreateFPToSI(Count, Int64Ty, "count");
+
+  // Variabili catturate: tutte le locali visibili, tranne quella di riduzione
+  std::vector<std::pair<const Symbol*, AllocaInst*>> captured;
+  for (auto &B : drv.NamedValues.visible())
+    if (B.first != RedVar && B.first != Var)
+      captured.push_back(B);
+
+  // Costruzione dell'ambiente nel chiamante
+  AllocaInst *LoAlloca = CreateEntryBlockAlloca(function, "pforstart");
+  drv.builder->CreateStore(Lo, LoAlloca);
+  AllocaInst *Env = CreateEntryBlockAlloca(function, "pforenv",
+                                           ArrayType::get(PtrTy, captured.size() + 1));
+  drv.builder->CreateStore(LoAlloca, drv.builder->CreateConstGEP1_64(PtrTy, Env, 0));
+  std::vector<bool> arrays;
+  for (size_t j = 0; j < captured.size(); j++) {
+    Value *Base = ArrayBase(drv, captured[j].second, captured[j].first->name);
+    arrays.push_back(Base);
+    drv.builder->CreateStore(Base ? Base : captured[j].second,
+                             drv.builder->CreateConstGEP1_64(PtrTy, Env, j + 1));
+  }
+
+  // Generazione della funzione che esegue un intervallo di iterazioni. Il builder
+  // viene spostato nella nuova funzione e riportato al punto corrente al termine
+  BasicBlock *CallerBB = drv.builder->GetInsertBlock();
+  FunctionType *BodyTy = FunctionType::get(Type::getVoidTy(*drv.context),
+                                           {PtrTy, Int64Ty, Int64Ty, PtrTy}, false);
+  Function *BodyF = Function::Create(BodyTy, Function::InternalLinkage,
+                                     function->getName() + ".pfor", *drv.module);
+  Argument *EnvArg = BodyF->getArg(0), *Begin = BodyF->getArg(1),
+           *EndArg = BodyF->getArg(2), *Partial = BodyF->getArg(3);
+  EnvArg->setName("env");
+  Begin->setName("begin");
+  EndArg->setName("end");
+  Partial->setName("partial");
+  BasicBlock *EntryBB = BasicBlock::Create(*drv.context, "entry", BodyF);
+  drv.builder->SetInsertPoint(EntryBB);
+
+  size_t scope = drv.NamedValues.enter();
+  std::vector<AllocaInst*> privates;
+  for (size_t j = 0; j < captured.size(); j++) {
+    StringRef name = captured[j].first->name;
+    Value *Ptr = drv.builder->CreateLoad(PtrTy,
+        drv.builder->CreateConstGEP1_64(PtrTy, EnvArg, j + 1), name + ".addr");
+    // Gli array sono visti dal corpo come parametri array, gli scalari come copie
+    AllocaInst *A = CreateEntryBlockAlloca(BodyF, name, arrays[j] ? PtrTy : DoubleTy);
+    drv.builder->CreateStore(arrays[j] ? Ptr : drv.builder->CreateLoad(DoubleTy, Ptr, name), A);
+    drv.NamedValues.bind(captured[j].first, A);
+    if (!arrays[j])
+      privates.push_back(A);
+  }
+  Value *BodyLo = drv.builder->CreateLoad(DoubleTy,
+      drv.builder->CreateLoad(PtrTy, EnvArg, "pforstart.addr"), "pforstart");
+  AllocaInst *VarAlloca = CreateEntryBlockAlloca(BodyF, Var->name);
+  drv.NamedValues.bind(Var, VarAlloca);
+  AllocaInst *Acc = nullptr;
+  if (RedOp) {
+    Acc = CreateEntryBlockAlloca(BodyF, RedVar->name);
+    drv.builder->CreateStore(drv.builder->CreateLoad(DoubleTy, Partial, "partial"), Acc);
+    drv.NamedValues.bind(RedVar, Acc);
+  }
+
+  // Ciclo sugli indici k in [begin, end), con i = a + k
+  BasicBlock *CondBB = BasicBlock::Create(*drv.context, "pforcond", BodyF);
+  BasicBlock *LoopBB = BasicBlock::Create(*drv.context, "pforloop", BodyF);
+  BasicBlock *ExitBB = BasicBlock::Create(*drv.context, "pforexit");
+  drv.builder->CreateBr(CondBB);
+  drv.builder->SetInsertPoint(CondBB);
+  PHINode *K = drv.builder->CreatePHI(Int64Ty, 2, "k");
+  K->addIncoming(Begin, EntryBB);
+  drv.builder->CreateCondBr(drv.builder->CreateICmpSLT(K, EndArg, "pfortest"), LoopBB, ExitBB);
+  drv.builder->SetInsertPoint(LoopBB);
+  drv.builder->CreateStore(drv.builder->CreateFAdd(BodyLo,
+      drv.builder->CreateSIToFP(K, DoubleTy), Var->name), VarAlloca);
+  Value *BodyV = Body->codegen(drv);
+  drv.NamedValues.leave(scope);
+  // Uno scalare catturato non può essere assegnato nel corpo: la sua copia privata
+  // ha come unico store quello dell'inizializzazione
+  for (AllocaInst *A : privates) {
+    if (!BodyV)
+      break;
+    unsigned stores = std::count_if(A->user_begin(), A->user_end(), [A](User *U) {
+      return isa<StoreInst>(U) && cast<StoreInst>(U)->getPointerOperand() == A;
+    });
+    if (stores > 1)
+      BodyV = LogErrorV("La variabile " + A->getName().str() + " non può essere assegnata"
+                        " nel corpo di pfor (usare reduce)");
+  }
+  if (!BodyV) {
+    delete ExitBB;
+    BodyF->eraseFromParent();
+    drv.builder->SetInsertPoint(CallerBB);
+    return nullptr;
+  }
+  K->addIncoming(drv.builder->CreateAdd(K, ConstantInt::get(Int64Ty, 1), "nextk"),
+                 drv.builder->GetInsertBlock());
+  drv.builder->CreateBr(CondBB);
+  BodyF->insert(BodyF->end(), ExitBB);
+  drv.builder->SetInsertPoint(ExitBB);
+  if (Acc)
+    drv.builder->CreateStore(drv.builder->CreateLoad(DoubleTy, Acc, RedVar->name), Partial);
+  drv.builder->CreateRetVoid();
+  verifyFunction(*BodyF);
+  if (drv.stream_ir) {
+    BodyF->print(errs());
+    fprintf(stderr, "\n");
+  }
+
+  // Chiamata al runtime e accumulo del risultato della riduzione
+  drv.builder->SetInsertPoint(CallerBB);
+  Function *Runtime = drv.module->getFunction("__krt_pfor");
+  if (!Runtime) {
+    Runtime = Function::Create(FunctionType::get(DoubleTy,
+        {PtrTy, PtrTy, Int64Ty, Type::getInt32Ty(*drv.context)}, false),
+        Function::ExternalLinkage, "__krt_pfor", *drv.module);
+    if (drv.stream_ir) {
+      Runtime->print(errs());
+      fprintf(stderr, "\n");
+    }
+  }
+  Value *Total = drv.builder->CreateCall(Runtime,
+      {BodyF, Env, Count, drv.builder->getInt32(RedOp)}, "pfortotal");
+  if (RedOp) {
+    Value *Old = drv.builder->CreateLoad(DoubleTy, RedAlloca, RedVar->name);
+    drv.builder->CreateStore(RedOp == '+' ? drv.builder->CreateFAdd(Old, Total, "redres")
+                                          : drv.builder->CreateFMul(Old, Total, "redres"),
+                             RedAlloca);
+  }
+  return Constant::getNullValue(DoubleTy);
+};
+
 /********************** Block Expression Tree *********************/
 BlockExprAST::BlockExprAST(std::vector<VarBindingAST*> Def, std::vector<ExprAST*> Val): 
          Def(std::move(Def)), Val(std::move(Val)) {};
 
+bool BlockExprAST::pure(const driver& drv, std::vector<const Symbol*>& locals) const {
+  size_t scope = locals.size();
+  bool ok = true;
+  for (auto def : Def)
+    ok = ok && def->pure(drv, locals);
+  for (auto val : Val)
+    ok = ok && val->pure(drv, locals);
+  locals.resize(scope);
+  return ok;
+};
+
+bool BlockExprAST::eval(Evaluator& ev, double& val) const {
+  size_t scope = ev.values.enter();
+  bool ok = true;
+  for (auto def : Def)
+    ok = ok && def->eval(ev);
+  for (auto v : Val)
+    ok = ok && v->eval(ev, val);
+  ev.values.leave(scope);
+  return ok;
+};
+
+// Il valore del blocco è quello dell'ultima espressione. Le chiamate di coda non
+// attraversano però i blocchi con array di dimensione variabile, perché all'uscita
+// va ripristinato lo stack
+void BlockExprAST::tail(TailRec& info) {
+  if (!Val.empty() && std::none_of(Def.begin(), Def.end(), [](VarBindingAST* D) { return D->dynamic(); }))
+    Val.back()->tail(info);
+};
+
 Value* BlockExprAST::codegen(driver& drv) {
    // Un blocco è un'espressione preceduta dalla definizione di una o più variabili locali.
    // Le definizioni sono opzionali e tuttavia necessarie perché l'uso di un blocco
@@ -396,20 +2148,26 @@ Value* BlockExprAST::codegen(driver& drv) {
    //    Questa deve essere inserita nella symbol table per futuri riferimenti ad y
    //    all'interno del blocco. Tuttavia, se un'istruzione alloca per y fosse già presente nella symbol
    //    table (nel caso y sia un parametro) bisognerebbe "rimuoverla" temporaneamente e re-inserirla
-   //    all'uscita del blocco. Questo è ciò che viene fatto dal presente codice, che utilizza
-   //    al riguardo il vettore di appoggio "AllocaTmp" (che naturalmente è un vettore di
-   //    di (puntatori ad) istruzioni di allocazione
-   std::vector<AllocaInst*> AllocaTmp;
+   //    all'uscita del blocco. Questo è ciò che fa la symbol table: il blocco apre un nuovo
+   //    scope, i binding vi vengono registrati (salvando quelli che oscurano) e alla chiusura
+   //    dello scope i binding oscurati vengono ripristinati
+   size_t scope = drv.NamedValues.enter();
+   // Gli array di dimensione variabile sono allocati sullo stack nel punto in cui
+   // sono definiti: all'uscita dal blocco lo stack viene riportato allo stato
+   // iniziale, in modo che un blocco eseguito in un ciclo non lo faccia crescere
+   Value *SavedStack = nullptr;
+   if (std::any_of(Def.begin(), Def.end(), [](VarBindingAST* D) { return D->dynamic(); }))
+     SavedStack = drv.builder->CreateCall(
+         Intrinsic::getDeclaration(drv.module.get(), Intrinsic::stacksave), {}, "savedstack");
    for (int i=0, e=Def.size(); i<e; i++) {
       // Per ogni definizione di variabile si genera il corrispondente codice che
       // (in questo caso) non restituisce un registro SSA ma l'istruzione di allocazione
       AllocaInst *boundval = Def[i]->codegen(drv);
       if (!boundval) 
          return nullptr;
-      // Viene temporaneamente rimossa la precedente istruzione di allocazione
-      // della stessa variabile (nome) e inserita quella corrente
-      AllocaTmp.push_back(drv.NamedValues[Def[i]->getName()]);
-      drv.NamedValues[Def[i]->getName()] = boundval;
+      // L'istruzione di allocazione corrente oscura, fino alla chiusura dello
+      // scope, quella di un'eventuale variabile omonima esterna
+      drv.NamedValues.bind(Def[i]->getName(), boundval);
    };
    // Ora (ed è la parte più "facile" da capire) viene generato il codice che
    // valuta l'espressione. Eventuali riferimenti a variabili vengono risolti
@@ -422,22 +2180,43 @@ Value* BlockExprAST::codegen(driver& drv) {
    }
 
    // Prima di uscire dal blocco, si ripristina lo scope esterno al costrutto
-   for (int i=0, e=Def.size(); i<e; i++) {
-        drv.NamedValues[Def[i]->getName()] = AllocaTmp[i];
-   };
+   drv.NamedValues.leave(scope);
+   if (SavedStack)
+     drv.builder->CreateCall(
+         Intrinsic::getDeclaration(drv.module.get(), Intrinsic::stackrestore), {SavedStack});
    // Il valore del costrutto/espressione var è ovviamente il valore (il registro SSA)
    // restituito dal codice di valutazione dell'espressione
    return blockvalue;
 };
 
 /************************* Var binding Tree *************************/
-VarBindingAST::VarBindingAST(const std::string Name, ExprAST* Val):
-   Name(Name), Val(Val) {};
+VarBindingAST::VarBindingAST(const Symbol* Name, ExprAST* Val, ExprAST* Size):
+   Name(Name), Val(Val), Size(Size) {};
+
+bool VarBindingAST::dynamic() const {
+   return Size && !dynamic_cast<NumberExprAST*>(Size);
+};
    
-const std::string& VarBindingAST::getName() const { 
+const Symbol* VarBindingAST::getName() const { 
    return Name; 
 };
 
+// Il valore iniziale è valutato prima che la variabile diventi visibile
+bool VarBindingAST::pure(const driver& drv, std::vector<const Symbol*>& locals) const {
+  if (Size || !Val || !Val->pure(drv, locals))
+    return false;
+  locals.push_back(Name);
+  return true;
+};
+
+bool VarBindingAST::eval(Evaluator& ev) const {
+  double init;
+  if (!Val->eval(ev, init))
+    return false;
+  ev.bind(Name, init);
+  return true;
+};
+
 AllocaInst* VarBindingAST::codegen(driver& drv) {
    // Viene subito recuperato il riferimento alla funzione in cui si trova
    // il blocco corrente. Il riferimento è necessario perché lo spazio necessario
@@ -445,36 +2224,85 @@ AllocaInst* VarBindingAST::codegen(driver& drv) {
    // di un parametro oppure di una variabile locale ad un blocco espressione)
    // viene sempre riservato nell'entry block della funzione. Ricordiamo che
    // l'allocazione viene fatta tramite l'utility CreateEntryBlockAlloca
-   Function *fun = builder->GetInsertBlock()->getParent();
+   Function *fun = drv.builder->GetInsertBlock()->getParent();
+   if (Size)
+      return array(drv, fun);
    // Ora viene generato il codice che definisce il valore della variabile
    Value *BoundVal = Val->codegen(drv);
    if (!BoundVal)  // Qualcosa è andato storto nella generazione del codice?
       return nullptr;
    // Se tutto ok, si genera l'istruzione che alloca memoria per la varibile ...
-   AllocaInst *Alloca = CreateEntryBlockAlloca(fun, Name);
+   AllocaInst *Alloca = CreateEntryBlockAlloca(fun, Name->name);
    // ... e si genera l'istruzione per memorizzarvi il valore dell'espressione,
    // ovvero il contenuto del registro BoundVal
-   builder->CreateStore(BoundVal, Alloca);
+   drv.builder->CreateStore(BoundVal, Alloca);
    
    // L'istruzione di allocazione (che include il registro "puntatore" all'area di memoria
    // allocata) viene restituita per essere inserita nella symbol table
    return Alloca;
 };
 
+// Un array di dimensione costante viene allocato, come gli scalari, nell'entry block;
+// uno di dimensione variabile nel punto della definizione (il blocco che lo contiene
+// ripristina lo stack alla sua uscita). In entrambi i casi la memoria è allineata
+// ad una linea di cache e azzerata, come quella degli array globali
+AllocaInst* VarBindingAST::array(driver& drv, Function *fun) {
+   Type *DoubleTy = Type::getDoubleTy(*drv.context);
+   AllocaInst *Alloca;
+   Value *Bytes;
+   if (!dynamic()) {
+      double N = std::get<double>(Size->getLexVal());
+      if (N < 1 || N != (uint64_t)N)
+         return (AllocaInst*)LogErrorV("Dimensione non valida per l'array " + Name->name.str());
+      Alloca = CreateEntryBlockAlloca(fun, Name->name, ArrayType::get(DoubleTy, (uint64_t)N));
+      Bytes = drv.builder->getInt64((uint64_t)N * sizeof(double));
+   } else {
+      Value *N = Size->codegen(drv);
+      if (!N)
+         return nullptr;
+      N = drv.builder->CreateFPToSI(N, Type::getInt64Ty(*drv.context), "size");
+      Alloca = drv.builder->CreateAlloca(DoubleTy, N, Name->name);
+      Bytes = drv.builder->CreateMul(N, drv.builder->getInt64(sizeof(double)), "bytes");
+   }
+   Alloca->setAlignment(ArrayAlign);
+   drv.builder->CreateMemSet(Alloca, drv.builder->getInt8(0), Bytes, ArrayAlign);
+   return Alloca;
+};
+
 /************************* Prototype Tree *************************/
-PrototypeAST::PrototypeAST(std::string Name, std::vector<std::string> Args):
-  Name(Name), Args(std::move(Args)), emitcode(true) {};  // Di regola il codice viene emesso
+PrototypeAST::PrototypeAST(const Symbol* Name, std::vector<std::pair<const Symbol*,bool>> Params):
+  Name(Name), emitcode(true) {  // Di regola il codice viene emesso
+  for (auto &P : Params) {
+    Args.push_back(P.first);
+    Arrays.push_back(P.second);
+  }
+};
+
+bool PrototypeAST::isArray(unsigned i) const {
+  return Arrays[i];
+};
 
 lexval PrototypeAST::getLexVal() const {
-   lexval lval = Name;
+   lexval lval = Name->name.str();
    return lval;	
 };
 
-const std::vector<std::string>& PrototypeAST::getArgs() const { 
+const std::vector<const Symbol*>& PrototypeAST::getArgs() const { 
    return Args;
 };
 
 // Previene la doppia emissione del codice. Si veda il commento più avanti.
+std::string PrototypeAST::signature() const {
+  std::string sig = Name->name.str() + "(";
+  for (unsigned i = 0; i < Args.size(); i++)
+    sig += isArray(i) ? "[]," : "x,";
+  return sig + ")";
+};
+
+const Symbol* PrototypeAST::getName() const {
+  return Name;
+};
+
 void PrototypeAST::noemit() { 
    emitcode = false; 
 };
@@ -486,20 +2314,24 @@ Function *PrototypeAST::codegen(driver& drv) {
   // i parametri. Si ricordi, tuttavia, che nel nostro caso l'unico tipo è double.
   
   // Prima definiamo il vettore (qui chiamato Doubles) con il tipo degli argomenti
-  std::vector<Type*> Doubles(Args.size(), Type::getDoubleTy(*context));
+  std::vector<Type*> Doubles(Args.size(), Type::getDoubleTy(*drv.context));
+  // (i parametri array fanno eccezione: sono puntatori al primo elemento)
+  for (unsigned i = 0; i < Args.size(); i++)
+    if (Arrays[i])
+      Doubles[i] = PointerType::getUnqual(*drv.context);
   // Quindi definiamo il tipo (FT) della funzione
-  FunctionType *FT = FunctionType::get(Type::getDoubleTy(*context), Doubles, false);
+  FunctionType *FT = FunctionType::get(Type::getDoubleTy(*drv.context), Doubles, false);
   // Infine definiamo una funzione (al momento senza body) del tipo creato e con il nome
   // presente nel nodo AST. 
   // ExternalLinkage vuol dire che la funzione può avere visibilità anche al di fuori del modulo
-  Function *F = Function::Create(FT, Function::ExternalLinkage, Name, *module);
+  Function *F = Function::Create(FT, Function::ExternalLinkage, Name->name, *drv.module);
 
   // Ad ogni parametro della funzione F (che, è bene ricordare, è la rappresentazione 
   // llvm di una funzione, non è una funzione C++) attribuiamo ora il nome specificato dal
   // programmatore e presente nel nodo AST relativo al prototipo
   unsigned Idx = 0;
   for (auto &Arg : F->args())
-    Arg.setName(Args[Idx++]);
+    Arg.setName(Args[Idx++]->name);
 
   /* Abbiamo completato la creazione del codice del prototipo.
      Il codice può quindi essere emesso, ma solo se esso corrisponde ad una dichiarazione extern. 
@@ -508,7 +2340,7 @@ Function *PrototypeAST::codegen(driver& drv) {
      In caso contrario nel codice si avrebbe sia una dichiarazione (come nel caso di funzione esterna)
      sia una definizione della stessa funzione.
   */
-  if (emitcode) {
+  if (emitcode && drv.stream_ir) {
     F->print(errs());
     fprintf(stderr, "\n");
   };
@@ -517,12 +2349,44 @@ Function *PrototypeAST::codegen(driver& drv) {
 }
 
 /************************* Function Tree **************************/
-FunctionAST::FunctionAST(PrototypeAST* Proto, ExprAST* Body): Proto(Proto), Body(Body) {};
+FunctionAST::FunctionAST(PrototypeAST* Proto, ExprAST* Body, const yy::location& Loc):
+  Proto(Proto), Body(Body), Loc(Loc) {};
+
+const Symbol* FunctionAST::getName() const {
+  return Proto->getName();
+};
+
+PrototypeAST* FunctionAST::getProto() const {
+  return Proto;
+};
+
+bool FunctionAST::pure(const driver& drv) const {
+  for (unsigned i = 0; i < Proto->getArgs().size(); i++)
+    if (Proto->isArray(i))
+      return false;
+  std::vector<const Symbol*> locals = Proto->getArgs();
+  return Body->pure(drv, locals);
+};
+
+// I parametri sono legati agli argomenti in uno scope proprio della chiamata;
+// l'analisi di purezza garantisce che il corpo non faccia riferimento ad altre
+// variabili, per cui quelle del chiamante, pur visibili nella tabella, non
+// vengono mai lette
+bool FunctionAST::eval(Evaluator& ev, const std::vector<double>& args, double& val) const {
+  if (args.size() != Proto->getArgs().size())
+    return false;
+  size_t scope = ev.values.enter();
+  for (size_t i = 0; i < args.size(); i++)
+    ev.bind(Proto->getArgs()[i], args[i]);
+  bool ok = Body->eval(ev, val);
+  ev.values.leave(scope);
+  return ok;
+};
 
 Function *FunctionAST::codegen(driver& drv) {
   // Verifica che la funzione non sia già presente nel modulo, cioè che non si tenti una "doppia definizione"
   Function *function = 
-      module->getFunction(std::get<std::string>(Proto->getLexVal()));
+      drv.module->getFunction(std::get<std::string>(Proto->getLexVal()));
   // Se la funzione non è già presente, si prova a definirla, innanzitutto
   // generando (ma non emettendo) il codice del prototipo
   if (!function)
@@ -533,9 +2397,28 @@ Function *FunctionAST::codegen(driver& drv) {
   if (!function)
     return nullptr;  
 
+  // Gli attributi registrano nella funzione le ipotesi floating point con cui è
+  // stata compilata: i passi che operano su intere funzioni (es. il vettorizzatore
+  // di riduzioni) e la selezione delle istruzioni li consultano al posto dei flag
+  // delle singole istruzioni
+  if (drv.fmf.isFast())
+    function->addFnAttr("unsafe-fp-math", "true");
+  if (drv.fmf.noNaNs())
+    function->addFnAttr("no-nans-fp-math", "true");
+  if (drv.fmf.noInfs())
+    function->addFnAttr("no-infs-fp-math", "true");
+  if (drv.fmf.noSignedZeros())
+    function->addFnAttr("no-signed-zeros-fp-math", "true");
+  if (drv.fmf.approxFunc())
+    function->addFnAttr("approx-func-fp-math", "true");
+
+  // Individuazione delle chiamate ricorsive di coda del corpo (vedi TailRec)
+  drv.tailrec = TailRec{Proto->getName(), drv.fmf.allowReassoc(), 0, false, nullptr, {}, nullptr};
+  Body->tail(drv.tailrec);
+
   // Altrimenti si crea un blocco di base in cui iniziare a inserire il codice
-  BasicBlock *BB = BasicBlock::Create(*context, "entry", function);
-  builder->SetInsertPoint(BB);
+  BasicBlock *BB = BasicBlock::Create(*drv.context, "entry", function);
+  drv.builder->SetInsertPoint(BB);
  
   // Ora viene la parte "più delicata". Per ogni parametro formale della funzione, 
   // nella symbol table si registra una coppia in cui la chiave è il nome del parametro 
@@ -548,82 +2431,158 @@ Function *FunctionAST::codegen(driver& drv) {
   // Si noti che il builder conosce il registro che contiene il puntatore all'area
   // perché esso è parte della rappresentazione C++ dell'istruzione di allocazione (variabile Alloca) 
   
+  // I parametri appartengono ad uno scope proprio della funzione, chiuso al termine
+  // della codegen (anche in caso di errore, insieme agli scope interni rimasti aperti)
+  size_t scope = drv.NamedValues.enter();
   for (auto &Arg : function->args()) {
     // Genera l'istruzione di allocazione per il parametro corrente
-    AllocaInst *Alloca = CreateEntryBlockAlloca(function, Arg.getName());
+    AllocaInst *Alloca = CreateEntryBlockAlloca(function, Arg.getName(), Arg.getType());
     // Genera un'istruzione per la memorizzazione del parametro nell'area di memoria allocata
-    builder->CreateStore(&Arg, Alloca);
+    drv.builder->CreateStore(&Arg, Alloca);
     // Registra gli argomenti nella symbol table per eventuale riferimento futuro
-    drv.NamedValues[std::string(Arg.getName())] = Alloca;
+    drv.NamedValues.bind(Proto->getArgs()[Arg.getArgNo()], Alloca);
+    drv.tailrec.params.push_back(Alloca);
   } 
+
+  // Con -finstrument=calls l'ingresso nella funzione viene segnalato al runtime
+  // (prima del ciclo delle chiamate ricorsive di coda, che non sono nuove chiamate)
+  GlobalVariable *Site = nullptr;
+  if (drv.instrument_calls) {
+    Site = InstrSite(drv, function->getName(), Loc, 'f');
+    drv.builder->CreateCall(InstrRuntime(drv, "__krt_enter"), {Site});
+  }
+
+  // Con chiamate ricorsive di coda il corpo inizia in un proprio blocco, a cui
+  // saltano le chiamate dopo aver aggiornato i parametri; l'accumulatore parte
+  // dall'elemento neutro della sua operazione
+  Type *DoubleTy = Type::getDoubleTy(*drv.context);
+  if (drv.tailrec.recursive) {
+    if (drv.tailrec.op) {
+      drv.tailrec.acc = CreateEntryBlockAlloca(function, "acc");
+      drv.builder->CreateStore(ConstantFP::get(DoubleTy, drv.tailrec.op == '+' ? 0.0 : 1.0),
+                               drv.tailrec.acc);
+    }
+    drv.tailrec.loop = BasicBlock::Create(*drv.context, "tailrecurse", function);
+    drv.builder->CreateBr(drv.tailrec.loop);
+    drv.builder->SetInsertPoint(drv.tailrec.loop);
+  }
   
   // Ora può essere generato il codice corssipondente al body (che potrà
   // fare riferimento alla symbol table)
-  if (Value *RetVal = Body->codegen(drv)) {
+  Value *RetVal = Body->codegen(drv);
+  drv.NamedValues.leave(scope);
+  if (RetVal) {
     // Se la generazione termina senza errori, ciò che rimane da fare è
     // di generare l'istruzione return, che ("a tempo di esecuzione") prenderà
-    // il valore lasciato nel registro RetVal 
-    builder->CreateRet(RetVal);
+    // il valore lasciato nel registro RetVal (combinato con l'accumulatore, se
+    // presente). Se il corpo termina con una chiamata di coda il blocco corrente
+    // è già terminato
+    if (!drv.builder->GetInsertBlock()->getTerminator()) {
+      if (drv.tailrec.acc) {
+        Value *Acc = drv.builder->CreateLoad(DoubleTy, drv.tailrec.acc, "acc");
+        RetVal = drv.tailrec.op == '+' ? drv.builder->CreateFAdd(Acc, RetVal, "retval")
+                                       : drv.builder->CreateFMul(Acc, RetVal, "retval");
+      }
+      drv.builder->CreateRet(RetVal);
+    }
+    if (Site)
+      InstrExits(drv, function, Site);
 
     // Effettua la validazione del codice e un controllo di consistenza
     verifyFunction(*function);
  
-    // Emissione del codice su stderr
-    function->print(errs());
-    fprintf(stderr, "\n");
+    // Emissione del codice su stderr (se non è richiesta l'emissione dell'intero modulo)
+    if (drv.stream_ir) {
+      function->print(errs());
+      fprintf(stderr, "\n");
+    }
     return function;
   }
 
   // Errore nella definizione. La funzione viene rimossa
   function->eraseFromParent();
+  if (Site)
+    Site->eraseFromParent();
   return nullptr;
 };
 
 /************************* Global Variable Tree **************************/
-GlobalVariableAST::GlobalVariableAST(const std::string Name): Name(Name) {};
+GlobalVariableAST::GlobalVariableAST(const Symbol* Name, double Size): Name(Name), Size(Size) {};
  
 lexval GlobalVariableAST::getLexVal() const {
-  lexval lval = Name;
+  lexval lval = Name->name.str();
   return lval;
 };
 
 Value *GlobalVariableAST::codegen(driver& drv) {  
+  // un array globale ha tipo [Size x double] ed è inizializzato a zero come gli scalari
+  Type *T = Type::getDoubleTy(*drv.context);
+  if (Size) {
+    if (Size < 1 || Size != (uint64_t)Size)
+      return LogErrorV("Dimensione non valida per l'array " + Name->name.str());
+    T = ArrayType::get(T, (uint64_t)Size);
+  }
   // inizializzazione di una variabile globale
   GlobalVariable *GlobalV = new GlobalVariable(
-   	  *module,
-   	  Type::getDoubleTy(*context),
+   	  *drv.module,
+   	  T,
    	  false, // non è una costante
    	  GlobalValue::CommonLinkage, // definisce le regole che governano la condivisione della variabile tra moduli
                                   // in questo caso, dichiaro una variabile che potrà essere condivisa tra più unità di traduzione durante il collegamento
                                   // (in caso di più definizioni in diversi moduli, il linker risolve i conflitti, mantenendo una sola copia della variabile)
-	    ConstantFP::get(*context, APFloat(0.0)), // valore iniziale
-   	  Name);
+	    Constant::getNullValue(T), // valore iniziale (0.0 per ogni elemento)
+   	  Name->name);
+  if (Size)
+    GlobalV->setAlignment(ArrayAlign);
   // a questo punto la variabile globale è già presente, con un proprio valore, nel modulo specificato
 
   // le seguenti istruzioni sono necessarie affinché il file .ll venga generato correttamente
-  GlobalV->print(errs());
-  fprintf(stderr, "\n");
+  if (drv.stream_ir) {
+    GlobalV->print(errs());
+    fprintf(stderr, "\n");
+  }
 
   return GlobalV; // puntatore alla variabile globale appena creata
 };
 
 /************************* Assignment Tree **************************/
-AssignmentAST::AssignmentAST(const std::string VName, ExprAST* VValue):
-  VName(VName), VValue(VValue) {};
+AssignmentAST::AssignmentAST(const Symbol* VName, ExprAST* VValue, ExprAST* Index):
+  VName(VName), VValue(VValue), Index(Index) {};
 
-const std::string& AssignmentAST::getName() const { 
+const Symbol* AssignmentAST::getName() const { 
    return VName; 
 };
 
+bool AssignmentAST::pure(const driver& drv, std::vector<const Symbol*>& locals) const {
+  return !Index && std::find(locals.begin(), locals.end(), VName) != locals.end() &&
+         VValue->pure(drv, locals);
+};
+
+bool AssignmentAST::eval(Evaluator& ev, double& val) const {
+  double* cell = ev.values.lookup(VName);
+  if (Index || !cell || !VValue->eval(ev, val))
+    return false;
+  *cell = val;
+  return true;
+};
+
 Value *AssignmentAST::codegen(driver& drv) {
   // controllo la presenza di VName nello scope locale (symbol table)...
-  Value *Var = drv.NamedValues[VName];
-  if (!Var) {
-      // ...e nello scope globale (intero modulo)
-      Var = module->getNamedGlobal(VName);
-      if(!Var)
-        return LogErrorV("Variabile " + VName + " non definita (Assignment)");
-  }
+  // ...e nello scope globale (intero modulo)
+  Value *Var = LookupVar(drv, VName);
+  if (!Var)
+    return LogErrorV("Variabile " + VName->name.str() + " non definita (Assignment)");
+
+  // nel caso di un array, la destinazione è l'elemento indicato dall'indice
+  Value *Base = ArrayBase(drv, Var, VName->name);
+  if (Index) {
+    if (!Base)
+      return LogErrorV("Variabile " + VName->name.str() + " non è un array");
+    Var = ElementPtr(drv, Base, Index);
+    if (!Var)
+      return nullptr;
+  } else if (Base)
+    return LogErrorV("L'array " + VName->name.str() + " deve essere indicizzato");
 
   // se presente in uno dei due, genero il codice per il valore
   Value* AssignedValue = VValue->codegen(drv);
@@ -632,7 +2591,7 @@ Value *AssignmentAST::codegen(driver& drv) {
   }
 
   // eseguo l'assegnazione tramite l'istruzione "base" CreateStore (sostituendo un eventuale valore precedente)
-  builder->CreateStore(AssignedValue, Var);
+  drv.builder->CreateStore(AssignedValue, Var);
   
   return AssignedValue;
 };
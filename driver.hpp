@@ -7,15 +7,70 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/DerivedTypes.h"
+/********************* Optimization related modules ************************/
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/PGOOptions.h"
+#include "llvm/Support/VirtualFileSystem.h"
+/*********************** Code emission related modules *********************/
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/TargetParser/Host.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+/*************************** JIT related modules ***************************/
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Support/DynamicLibrary.h"
+/************************ Statistics related modules ***********************/
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Timer.h"
+#include <sys/resource.h>
+#include <unistd.h>
+/******************* Incremental compilation related modules ****************/
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SHA256.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+/************************ Whole program related modules ********************/
+#include "llvm/Transforms/IPO/Internalize.h"
+/********************** Memory management modules **************************/
+#include "llvm/Support/Allocator.h"
+/************************ Symbol table related modules *********************/
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
 /**************** C++ modules and generic data types ***********************/
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <set>
 #include <string>
 #include <vector>
 #include <variant>
@@ -31,24 +86,202 @@ using namespace llvm;
 // Per il parser è sufficiente una forward declaration
 YY_DECL;
 
+// Identificatore del programma. Lo scanner crea un solo Symbol per ogni testo
+// distinto (interning), per cui due occorrenze dello stesso identificatore sono
+// lo stesso oggetto; id è un indice progressivo e denso, usato dalla symbol table
+class Symbol {
+public:
+  StringRef name;     // Testo dell'identificatore (di proprietà del driver)
+  unsigned id;        // Indice del simbolo, nell'ordine in cui è stato incontrato
+};
+
+// Tabella con scope annidati che associa ai simboli valori di tipo T (puntatori).
+// Per ogni simbolo è memorizzato solo il binding attualmente visibile (ricerca in
+// tempo costante); i binding oscurati da una definizione più interna vengono
+// salvati e ripristinati alla chiusura dello scope
+template <typename T>
+class ScopedTable {
+public:
+  T lookup(const Symbol* sym) const;  // nullptr se il simbolo non è legato
+  void bind(const Symbol* sym, T val); // Lega il simbolo nello scope corrente
+  size_t enter();           // Apre uno scope e ne restituisce il livello
+  void leave(size_t scope); // Chiude tutti gli scope aperti a partire da quello indicato
+  std::vector<std::pair<const Symbol*, T>> visible() const; // Binding visibili, in ordine di id
+private:
+  std::vector<T> bindings;  // Binding corrente, indicizzato dall'id del simbolo
+  std::vector<const Symbol*> symbols; // Simbolo di ogni id legato almeno una volta
+  std::vector<std::pair<unsigned, T>> shadowed; // Binding oscurati, in ordine
+};
+
+// Symbol table della codegen: ad ogni variabile visibile è associata la sua alloca
+typedef ScopedTable<AllocaInst*> SymbolTable;
+
+class FunctionAST;
+
+// Chiamate ricorsive di coda della funzione in corso di generazione. Le chiamate
+// della funzione a se stessa in posizione di coda vengono individuate prima della
+// codegen del corpo (metodo tail dei nodi) e trasformate in salti all'inizio del
+// corpo, dopo aver assegnato ai parametri i nuovi valori. Con la riassociazione
+// ammessa (-ffast-math) anche le chiamate del tipo n*f(n-1) diventano salti: il
+// fattore n viene accumulato e il risultato della funzione è acc*(valore restituito)
+struct TailRec {
+  const Symbol* fn;     // Funzione generata
+  bool accumulate;      // Ammessa la riscrittura con accumulatore
+  char op;              // Operatore dell'accumulatore ('+' o '*'), 0 se non usato
+  bool recursive;       // Il corpo contiene chiamate ricorsive di coda
+  BasicBlock* loop;     // Inizio del corpo, destinazione dei salti
+  std::vector<AllocaInst*> params; // Alloca dei parametri
+  AllocaInst* acc;      // Accumulatore (nullptr se op è 0)
+};
+
+// Chiamate (funzione e argomenti) la cui valutazione è fallita, con le funzioni
+// invocate durante il tentativo
+typedef std::map<std::pair<const Symbol*, std::vector<double>>, std::set<const Symbol*>> EvalFailures;
+
+// Interprete dell'AST, usato per calcolare a tempo di compilazione le chiamate
+// di funzioni pure con argomenti costanti. Il numero di passi (chiamate e
+// iterazioni) e la profondità di ricorsione sono limitati: superato il limite
+// la valutazione fallisce e la chiamata viene compilata normalmente
+class Evaluator {
+public:
+  Evaluator(const std::map<const Symbol*, FunctionAST*>& functions, unsigned steps,
+            EvalFailures& failures);
+  const std::map<const Symbol*, FunctionAST*>& functions; // Funzioni pure valutabili
+  EvalFailures& failures;   // Chiamate già fallite, che non vengono ritentate
+  ScopedTable<double*> values; // Valori delle variabili visibili
+  unsigned steps;           // Passi ancora disponibili
+  unsigned depth;           // Profondità di ricorsione corrente
+  std::set<const Symbol*> used; // Funzioni invocate, da cui dipende il risultato
+  void bind(const Symbol* sym, double val); // Crea una variabile nello scope corrente
+  bool call(const Symbol* callee, const std::vector<double>& args, double& val);
+private:
+  std::deque<double> cells; // Memoria delle variabili (indirizzi stabili)
+};
+
 // Classe che organizza e gestisce il processo di compilazione
 class driver
 {
 public:
   driver();
-  std::map<std::string, AllocaInst*> NamedValues; // Tabella associativa in cui ogni 
-            // chiave x è una variabile e il cui corrispondente valore è un'istruzione 
-            // che alloca uno spazio di memoria della dimensione necessaria per 
-            // memorizzare un variabile del tipo di x (nel nostro caso solo double)
+  ~driver();
+  std::map<const Symbol*, FunctionAST*> purefuns; // Funzioni pure del sorgente corrente
+  unsigned evalbudget;      // Passi dell'interprete ancora disponibili per il sorgente corrente
+  EvalFailures evalfailures; // Valutazioni fallite nel sorgente corrente
+  SymbolTable NamedValues; // Tabella in cui ogni variabile x visibile è associata
+            // ad un'istruzione che alloca uno spazio di memoria della dimensione necessaria
+            // per memorizzare un variabile del tipo di x (nel nostro caso solo double)
+  const Symbol* intern(StringRef text); // Simbolo unico associato ad un identificatore
   RootAST* root;      // A fine parsing "punta" alla radice dell'AST
   int parse (const std::string& f);
+  int parse_string (std::string text, const std::string& name = "-"); // Parsing di un sorgente in memoria
   std::string file;
   bool trace_parsing; // Abilita le tracce di debug el parser
-  void scan_begin (); // Implementata nello scanner
+  bool scan_begin (); // Implementata nello scanner, false se il file non è leggibile
   void scan_end ();   // Implementata nello scanner
+  void error (const yy::location& l, const std::string& m); // Errore lessicale (nello scanner)
   bool trace_scanning;// Abilita le tracce di debug nello scanner
   yy::location location; // Utillizata dallo scanner per localizzare i token
+  void* scanner;      // Stato dello scanner (rientrante) associato a questo driver
+  std::string source; // Sorgente in memoria (parse_string o stdin), con i terminatori per flex
+  char* buffer;       // Testo analizzato dallo scanner: file mappato in memoria o source
+  size_t length;      // Lunghezza del testo, esclusi i due terminatori
+  size_t mapped;      // Dimensione della mappatura del file (0 se il testo è in source)
   void codegen();
+  unsigned optlevel;  // Livello di ottimizzazione richiesto (-O0, -O1, -O2, -O3)
+  std::string passes; // Pipeline personalizzata (-passes=...), ha la precedenza su optlevel
+  FastMathFlags fmf;  // Ipotesi ammesse sull'aritmetica floating point (-ffast-math, ...)
+  bool nobuiltin;     // Gli extern con il nome di funzioni di libm restano chiamate (-fno-builtin)
+  TargetLibraryInfoImpl::VectorLibrary veclib; // Libreria matematica vettoriale (-fveclib=)
+  bool instrument_calls; // Contatori e cicli di clock di ogni funzione (-finstrument=calls)
+  bool instrument_loops; // Iterazioni di ogni ciclo for (-finstrument=loops)
+  PGOOptions::PGOAction pgo; // Ottimizzazione guidata dal profilo: strumentazione
+                      // (-fprofile-generate) o uso di un profilo raccolto (-fprofile-use=)
+  std::string profile; // File .profraw da scrivere o file .profdata da usare
+  TailRec tailrec;    // Chiamate ricorsive di coda della funzione in corso di generazione
+  bool stream_ir;     // Emissione incrementale dell'IR su stderr durante la codegen
+  int optimize();     // Esegue la pipeline di ottimizzazione sull'intero modulo
+  std::string cpu;    // CPU per cui generare codice (-mcpu=, "native" per la CPU host)
+  TargetMachine* target; // Descrizione della macchina target (nullptr finché non inizializzata)
+  int inittarget();   // Inizializza il target nativo e lo associa al modulo
+  int emit(const std::string& f, CodeGenFileType type); // Emissione di codice oggetto o assembly
+  unsigned partitions; // Parti del modulo tradotte in codice oggetto in parallelo (-fparallel-codegen=)
+  int emit_ir(const std::string& f, bool bitcode);      // Emissione di IR testuale o bitcode
+  int run(const std::string& entry, const std::vector<double>& args); // Esecuzione tramite JIT
+  std::unique_ptr<LLVMContext> context; // Contesto LLVM proprio del driver
+  std::unique_ptr<Module> module;       // Modulo in cui viene generato il codice
+  std::unique_ptr<IRBuilder<>> builder; // Costruisce le istruzioni del codice intermedio
+  template <typename T, typename... Args>
+  T* make(Args&&... args); // Alloca un nodo dell'AST nell'arena del driver
+  void release();          // Distrugge l'intero AST e libera l'arena in un colpo solo
+  bool time_report;        // Misura tempi e statistiche delle fasi di compilazione (-ftime-report)
+  void report(raw_ostream& out, bool json); // Stampa del report delle fasi (testo o JSON)
+  // Compilazione incrementale (-fcache-dir=): ogni definizione di funzione viene
+  // generata e ottimizzata in un proprio modulo, memorizzato nella cache sotto
+  // l'hash del suo sorgente, delle opzioni e delle dichiarazioni che la precedono
+  std::string cachedir;    // Directory della cache, vuota se la cache è disabilitata
+  void define(const RootAST* item, const yy::location& loc); // Registra il sorgente di una definizione
+  void cachedcodegen(RootAST* item); // Codegen di un elemento top-level, o suo caricamento dalla cache
+  void cachelink();        // Completa il modulo con le definizioni generate e quelle caricate
+  std::set<const Symbol*> cached; // Funzioni caricate dalla cache: dichiarate, ma valutabili
+  std::set<const Symbol*> folded; // Funzioni pure valutate nella codegen della definizione corrente
+  // Modalità whole-program (--whole-program): ogni sorgente viene generato in un
+  // proprio modulo e i moduli vengono collegati prima dell'ottimizzazione
+  void beginunit();        // Inizia il modulo del prossimo sorgente
+  int linkunits();         // Collega i moduli e rende interni tutti i simboli non esportati
+  std::vector<std::string> exports; // Entry point del programma (--export), non internalizzati
+  // Sessione interattiva (--repl): ogni elemento top-level viene generato in un
+  // proprio modulo e aggiunto al JIT; le espressioni vengono eseguite subito
+  int repl(const std::vector<std::string>& files); // Carica i file e legge da stdin
+  void replcodegen(RootAST* item); // Codegen ed esecuzione di un elemento nella sessione
+  std::unique_ptr<orc::LLJIT> jit; // JIT della sessione, nullptr fuori dal REPL
+private:
+  // Funzione dichiarata nella sessione: tipo dei parametri e numero di definizioni
+  // (0 per un extern). Il corpo della definizione n-esima di f si chiama f.n e le
+  // chiamate passano per lo stub f, che viene reindirizzato a ogni ridefinizione
+  struct replfun {
+    std::vector<bool> arrays;
+    unsigned version;
+  };
+  std::map<std::string, replfun> replfuns;
+  std::map<std::string, uint64_t> replglobals; // Variabili globali: elementi (0 se scalare)
+  std::unique_ptr<orc::IndirectStubsManager> stubs; // Stub delle funzioni definite
+  int replstatus;           // 1 se qualche elemento della sessione è fallito
+  int emitsplit(const std::string& f); // Emissione del codice oggetto di partitions parti del modulo
+  std::vector<std::unique_ptr<Module>> units; // Moduli dei sorgenti già generati
+  // Definizione generata (owned non vuoto) o caricata dalla cache (module non nullo)
+  struct cacheentry {
+    std::string key;                // Hash della definizione
+    std::vector<Function*> owned;   // Funzioni generate: la definizione e i corpi dei suoi pfor
+    std::vector<const Symbol*> deps; // Funzioni pure valutate durante la codegen
+    std::unique_ptr<Module> module;
+    std::vector<GlobalVariable*> globals; // Variabili generate: i siti di -finstrument= e le loro stringhe
+  };
+  std::vector<cacheentry> pending; // Definizioni del sorgente corrente, in ordine
+  bool cacheerror;          // Fallita l'ottimizzazione di qualche definizione
+  std::string cacheiface;   // Dichiarazioni visibili (funzioni e variabili globali definite)
+  std::map<const RootAST*, std::string> sources; // Sorgente delle definizioni top-level
+  std::vector<size_t> linestarts; // Offset dell'inizio di ogni riga del sorgente
+  std::string digest(StringRef text) const; // Hash SHA-256 esadecimale
+  int optimize(Module& M);  // Esegue la pipeline di ottimizzazione su un modulo
+  void lowerbuiltins(Module& M); // Sostituisce le chiamate alle funzioni di libm con intrinsic
+  TargetLibraryInfoImpl libinfo(const Module& M) const; // Funzioni di libreria riconosciute
+  // Durata complessiva di una fase e picco di memoria residente del processo al suo termine
+  struct phase {
+    std::string name;
+    TimeRecord time;
+    long peakrss;
+  };
+  std::vector<phase> phases;    // Fasi misurate, nell'ordine in cui sono state eseguite
+  std::map<std::string, std::pair<unsigned, unsigned>> instcount; // Istruzioni IR per funzione
+                                // prima e dopo l'ottimizzazione
+  size_t astnodes;              // Nodi dell'AST allocati durante il parsing
+  size_t lines;                 // Righe di sorgente analizzate
+  size_t bytes;                 // Byte di sorgente analizzati
+  void endphase(const std::string& name, const TimeRecord& start);
+  BumpPtrAllocator arena;       // Arena da cui sono allocati tutti i nodi dell'AST
+  std::vector<RootAST*> nodes;  // Nodi allocati, di cui va invocato il distruttore
+  StringMap<Symbol> identifiers; // Identificatori incontrati dallo scanner (sopravvivono
+                                // all'AST, perché i simboli sono usati anche nella codegen)
 };
 
 typedef std::variant<std::string,double> lexval;
@@ -62,19 +295,32 @@ public:
   virtual Value *codegen(driver& drv) { return nullptr; };
 };
 
-// SeqAST - Classe che rappresenta la sequenza di statement
+// SeqAST - Classe che rappresenta la sequenza delle definizioni top-level
 class SeqAST : public RootAST {
 private:
-  RootAST* first;
-  RootAST* continuation;
+  std::vector<RootAST*> items;
 
 public:
-  SeqAST(RootAST* first, RootAST* continuation);
+  SeqAST(std::vector<RootAST*> items);
+  void analyze(driver& drv); // Individua le funzioni pure della sequenza
   Value *codegen(driver& drv) override;
 };
 
 /// ExprAST - Classe base per tutti i nodi espressione
-class ExprAST : public RootAST {};
+class ExprAST : public RootAST {
+public:
+  // true se la valutazione dell'espressione può avere effetti collaterali (chiamate,
+  // assegnamenti) o un costo non trascurabile; nel dubbio la risposta è true
+  virtual bool effects() const { return true; };
+  // true se l'espressione non legge né scrive variabili globali e chiama solo
+  // funzioni pure; locals contiene le variabili locali visibili
+  virtual bool pure(const driver& drv, std::vector<const Symbol*>& locals) const { return false; };
+  // Valutazione a tempo di compilazione, false se non è possibile
+  virtual bool eval(Evaluator& ev, double& val) const { return false; };
+  // Segnala che il valore dell'espressione è il risultato della funzione (posizione
+  // di coda) e registra in info le chiamate ricorsive di coda che contiene
+  virtual void tail(TailRec& info) {};
+};
 
 /// NumberExprAST - Classe per la rappresentazione di costanti numeriche
 class NumberExprAST : public ExprAST {
@@ -84,18 +330,27 @@ private:
 public:
   NumberExprAST(double Val);
   lexval getLexVal() const override;
+  bool effects() const override { return false; };
+  bool pure(const driver& drv, std::vector<const Symbol*>& locals) const override;
+  bool eval(Evaluator& ev, double& val) const override;
   Value *codegen(driver& drv) override;
 };
 
 /// VariableExprAST - Classe per la rappresentazione di riferimenti a variabili
+/// (o ad elementi di un array, se è presente l'indice)
 class VariableExprAST : public ExprAST {
 private:
-  std::string Name;
+  const Symbol* Name;
+  ExprAST* Index;
   
 public:
-  VariableExprAST(const std::string &Name);
+  VariableExprAST(const Symbol* Name, ExprAST* Index = nullptr);
   lexval getLexVal() const override;
+  bool effects() const override;
+  bool pure(const driver& drv, std::vector<const Symbol*>& locals) const override;
+  bool eval(Evaluator& ev, double& val) const override;
   Value *codegen(driver& drv) override;
+  Value *address(driver& drv); // Indirizzo del primo elemento, se la variabile è un array
 };
 
 /// BinaryExprAST - Classe per la rappresentazione di operatori binari
@@ -104,9 +359,15 @@ private:
   char Op;
   ExprAST* LHS;
   ExprAST* RHS;
+  CallExprAST* Accum;  // Chiamata ricorsiva di coda il cui risultato è combinato
+                       // con l'altro operando tramite l'accumulatore
 
 public:
   BinaryExprAST(char Op, ExprAST* LHS, ExprAST* RHS);
+  bool effects() const override;
+  bool pure(const driver& drv, std::vector<const Symbol*>& locals) const override;
+  bool eval(Evaluator& ev, double& val) const override;
+  void tail(TailRec& info) override;
   Value *codegen(driver& drv) override;
 };
 
@@ -119,18 +380,27 @@ private:
 
 public:
   LogicalExprAST(std::string Op, ExprAST* LHS, ExprAST* RHS);
+  bool effects() const override;
+  bool pure(const driver& drv, std::vector<const Symbol*>& locals) const override;
+  bool eval(Evaluator& ev, double& val) const override;
   Value *codegen(driver& drv) override;
 };
 
 /// CallExprAST - Classe per la rappresentazione di chiamate di funzione
 class CallExprAST : public ExprAST {
 private:
-  std::string Callee;
+  const Symbol* Callee;
   std::vector<ExprAST*> Args;  // ASTs per la valutazione degli argomenti
+  bool Tail;                   // La chiamata è in posizione di coda
 
 public:
-  CallExprAST(std::string Callee, std::vector<ExprAST*> Args);
+  CallExprAST(const Symbol* Callee, std::vector<ExprAST*> Args);
   lexval getLexVal() const override;
+  const Symbol* getCallee() const;
+  bool argeffects() const; // La valutazione di qualche argomento ha effetti collaterali
+  bool pure(const driver& drv, std::vector<const Symbol*>& locals) const override;
+  bool eval(Evaluator& ev, double& val) const override;
+  void tail(TailRec& info) override;
   Value *codegen(driver& drv) override;
 };
 
@@ -142,6 +412,10 @@ private:
   ExprAST* FalseExp;
 public:
   IfExprAST(ExprAST* Cond, ExprAST* TrueExp, ExprAST* FalseExp);
+  bool effects() const override;
+  bool pure(const driver& drv, std::vector<const Symbol*>& locals) const override;
+  bool eval(Evaluator& ev, double& val) const override;
+  void tail(TailRec& info) override;
   Value *codegen(driver& drv) override;
 };
 
@@ -152,8 +426,29 @@ private:
   ExprAST* Cond;
   AssignmentAST* StepExp;
   ExprAST* BlockExp;
+  yy::location Loc;   // Posizione nel sorgente (per -finstrument=loops)
 public:
-  ForExprAST(RootAST* StartExp, ExprAST* Cond, AssignmentAST* StepExp, ExprAST* BlockExp);
+  ForExprAST(RootAST* StartExp, ExprAST* Cond, AssignmentAST* StepExp, ExprAST* BlockExp,
+             const yy::location& Loc);
+  bool pure(const driver& drv, std::vector<const Symbol*>& locals) const override;
+  bool eval(Evaluator& ev, double& val) const override;
+  Value *codegen(driver& drv) override;
+};
+
+/// PForExprAST - Classe per la rappresentazione del ciclo parallelo PFOR: il corpo
+/// viene trasformato in una funzione che esegue un intervallo di iterazioni, e gli
+/// intervalli sono distribuiti fra i thread dal runtime (runtime/krt.cpp)
+class PForExprAST : public ExprAST {
+private:
+  const Symbol* Var;      // Variabile di controllo
+  ExprAST* Start;         // Valore iniziale
+  ExprAST* End;           // Limite (escluso) della variabile di controllo
+  ExprAST* Body;
+  char RedOp;             // Operatore di riduzione ('+', '*', oppure 0 se assente)
+  const Symbol* RedVar;   // Variabile in cui si accumula la riduzione
+public:
+  PForExprAST(const Symbol* Var, ExprAST* Start, ExprAST* End, ExprAST* Body,
+              char RedOp, const Symbol* RedVar);
   Value *codegen(driver& drv) override;
 };
 
@@ -164,31 +459,44 @@ private:
   std::vector<ExprAST*> Val;
 public:
   BlockExprAST(std::vector<VarBindingAST*> Def, std::vector<ExprAST*> Val);
+  bool pure(const driver& drv, std::vector<const Symbol*>& locals) const override;
+  bool eval(Evaluator& ev, double& val) const override;
+  void tail(TailRec& info) override;
   Value *codegen(driver& drv) override;
 }; 
 
 /// VarBindingAST - Classe che rappresenta l'allocazione in memoria di una variabile
+/// (scalare con valore iniziale Val, oppure array di Size elementi)
 class VarBindingAST: public RootAST {
 private:
-  const std::string Name;
+  const Symbol* Name;
   ExprAST* Val;
+  ExprAST* Size;
+  AllocaInst *array(driver& drv, Function *fun); // Allocazione di un array
 public:
-  VarBindingAST(const std::string Name, ExprAST* Val);
+  VarBindingAST(const Symbol* Name, ExprAST* Val, ExprAST* Size = nullptr);
+  bool dynamic() const; // Array la cui dimensione è nota solo a tempo di esecuzione
   AllocaInst *codegen(driver& drv) override;
-  const std::string& getName() const;
+  bool pure(const driver& drv, std::vector<const Symbol*>& locals) const;
+  bool eval(Evaluator& ev) const; // Crea la variabile con il valore iniziale
+  const Symbol* getName() const;
 };
 
 /// PrototypeAST - Classe per la rappresentazione dei prototipi di funzione
 /// (nome, numero e nome dei parametri; in questo caso il tipo è implicito perché unico)
 class PrototypeAST : public RootAST {
 private:
-  std::string Name;
-  std::vector<std::string> Args;
+  const Symbol* Name;
+  std::vector<const Symbol*> Args;
+  std::vector<bool> Arrays;   // Parametri di tipo array (passati per indirizzo)
   bool emitcode;
 
 public:
-  PrototypeAST(std::string Name, std::vector<std::string> Args);
-  const std::vector<std::string> &getArgs() const;
+  PrototypeAST(const Symbol* Name, std::vector<std::pair<const Symbol*,bool>> Params);
+  const std::vector<const Symbol*> &getArgs() const;
+  bool isArray(unsigned i) const;
+  const Symbol* getName() const;
+  std::string signature() const; // Nome e tipo dei parametri (senza i loro nomi)
   lexval getLexVal() const override;
   Function *codegen(driver& drv) override;
   void noemit();
@@ -200,31 +508,97 @@ private:
   PrototypeAST* Proto;
   ExprAST* Body;
   bool external;
+  yy::location Loc;   // Posizione nel sorgente (per -finstrument=calls)
   
 public:
-  FunctionAST(PrototypeAST* Proto, ExprAST* Body);
+  FunctionAST(PrototypeAST* Proto, ExprAST* Body, const yy::location& Loc);
   Function *codegen(driver& drv) override;
+  const Symbol* getName() const;
+  PrototypeAST* getProto() const;
+  bool pure(const driver& drv) const;
+  bool eval(Evaluator& ev, const std::vector<double>& args, double& val) const;
 };
 
 /// GlobalVariableAST - Classe che rappresenta la dichiarazione di una variabile globale
+/// (Size è il numero di elementi se la variabile è un array, 0 se è uno scalare)
 class GlobalVariableAST : public RootAST {
 private:
-  std::string Name;
+  const Symbol* Name;
+  double Size;
 public:
-  GlobalVariableAST(const std::string Name);
+  GlobalVariableAST(const Symbol* Name, double Size = 0);
   lexval getLexVal() const override;
   Value *codegen(driver& drv) override;
 };
 
 /// AssignmentAST - Classe che rappresenta l'operazione di assegnamento
+/// (ad una variabile o ad un elemento di un array, se è presente l'indice)
 class AssignmentAST : public ExprAST {
 private:
-  const std::string VName;
+  const Symbol* VName;
   ExprAST* VValue;
+  ExprAST* Index;
 public:
-  AssignmentAST(const std::string VName, ExprAST* VValue);
+  AssignmentAST(const Symbol* VName, ExprAST* VValue, ExprAST* Index = nullptr);
+  bool pure(const driver& drv, std::vector<const Symbol*>& locals) const override;
+  bool eval(Evaluator& ev, double& val) const override;
   Value *codegen(driver& drv) override;
-  const std::string& getName() const;
+  const Symbol* getName() const;
 };
 
+/*************************** Scoped table ***************************/
+// Il binding corrente di ogni identificatore è memorizzato in un vettore indicizzato
+// dall'id del simbolo, per cui la ricerca costa O(1). Ogni bind salva il binding che
+// oscura: chiudere uno scope significa ripristinare, in ordine inverso, i binding
+// salvati dopo la sua apertura
+template <typename T>
+T ScopedTable<T>::lookup(const Symbol* sym) const {
+  return sym->id < bindings.size() ? bindings[sym->id] : nullptr;
+}
+
+template <typename T>
+void ScopedTable<T>::bind(const Symbol* sym, T val) {
+  if (sym->id >= bindings.size()) {
+    bindings.resize(sym->id + 1, nullptr);
+    symbols.resize(sym->id + 1, nullptr);
+  }
+  symbols[sym->id] = sym;
+  shadowed.push_back({sym->id, bindings[sym->id]});
+  bindings[sym->id] = val;
+}
+
+template <typename T>
+size_t ScopedTable<T>::enter() {
+  return shadowed.size();
+}
+
+template <typename T>
+void ScopedTable<T>::leave(size_t scope) {
+  while (shadowed.size() > scope) {
+    bindings[shadowed.back().first] = shadowed.back().second;
+    shadowed.pop_back();
+  }
+}
+
+template <typename T>
+std::vector<std::pair<const Symbol*, T>> ScopedTable<T>::visible() const {
+  std::vector<std::pair<const Symbol*, T>> result;
+  for (size_t id = 0; id < bindings.size(); id++)
+    if (bindings[id])
+      result.push_back({symbols[id], bindings[id]});
+  return result;
+}
+
+/*************************** AST allocation ***************************/
+// I nodi dell'AST vengono creati dal parser esclusivamente attraverso questo metodo:
+// la memoria è presa dall'arena del driver (allocazione bump, contigua e senza
+// overhead per nodo) e il nodo viene registrato affinché release() possa invocarne
+// il distruttore, dato che i nodi contengono stringhe e vettori
+template <typename T, typename... Args>
+T* driver::make(Args&&... args) {
+  T* node = new (arena.Allocate<T>()) T(std::forward<Args>(args)...);
+  nodes.push_back(node);
+  return node;
+}
+
 #endif // ! DRIVER_HH
@@ -0,0 +1,12 @@
+#include "server.hpp"
+#include <iostream>
+
+// Client leggero del server di compilazione: non dipende da LLVM, per cui il suo
+// avvio non paga il caricamento delle librerie. Uso: kclient <socket> <opzioni di kcomp>
+int main (int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cerr << "Uso: " << argv[0] << " <socket> <opzioni di kcomp>" << std::endl;
+    return 1;
+  }
+  return client(argv[1], std::vector<std::string>(argv + 2, argv + argc));
+}
@@ -1,24 +1,386 @@
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include "driver.hpp"
+#include "server.hpp"
 
-extern LLVMContext *context;
-extern Module *module;
-extern IRBuilder<> *builder;
+// Copia le opzioni raccolte dalla linea di comando in un nuovo driver
+static void configure(driver& drv, const driver& opts) {
+  drv.trace_parsing = opts.trace_parsing;
+  drv.trace_scanning = opts.trace_scanning;
+  drv.optlevel = opts.optlevel;
+  drv.passes = opts.passes;
+  drv.fmf = opts.fmf;
+  drv.cpu = opts.cpu;
+  drv.stream_ir = opts.stream_ir;
+  drv.time_report = opts.time_report;
+  drv.cachedir = opts.cachedir;
+  drv.nobuiltin = opts.nobuiltin;
+  drv.veclib = opts.veclib;
+  drv.pgo = opts.pgo;
+  drv.profile = opts.profile;
+  drv.instrument_calls = opts.instrument_calls;
+  drv.instrument_loops = opts.instrument_loops;
+  drv.partitions = opts.partitions;
+}
 
-int main (int argc, char *argv[]) {
+// Librerie matematiche vettoriali ammesse da -fveclib= (stessi nomi di clang)
+static const std::map<std::string, TargetLibraryInfoImpl::VectorLibrary> veclibs = {
+  { "none", TargetLibraryInfoImpl::NoLibrary },
+  { "Accelerate", TargetLibraryInfoImpl::Accelerate },
+  { "Darwin_libsystem_m", TargetLibraryInfoImpl::DarwinLibSystemM },
+  { "libmvec", TargetLibraryInfoImpl::LIBMVEC_X86 },
+  { "MASSV", TargetLibraryInfoImpl::MASSV },
+  { "SVML", TargetLibraryInfoImpl::SVML },
+};
+
+// Destinazione dei report di -ftime-report (stderr o il file di -ftime-report-file);
+// con -j più driver vi scrivono, per cui l'accesso è serializzato
+static raw_ostream* reportout = &errs();
+static bool reportjson = false;
+static std::mutex reportlock;
+
+static void printreport(driver& drv) {
+  if (!drv.time_report)
+    return;
+  std::lock_guard<std::mutex> lock(reportlock);
+  drv.report(*reportout, reportjson);
+  reportout->flush();
+}
+
+// Formato del file prodotto: IR testuale su stderr man mano che viene generato
+// (comportamento di default), IR testuale, bitcode, assembly o codice oggetto
+enum outkind { OUT_STREAM, OUT_LL, OUT_BC, OUT_ASM, OUT_OBJ };
+
+// Nome di default del file di output, derivato da quello del sorgente
+static std::string outname(const std::string& f, outkind kind) {
+  static const char* ext[] = { "", ".ll", ".bc", ".s", ".o" };
+  return f.substr(0, f.rfind('.')) + ext[kind];
+}
+
+// Scrittura dell'intero modulo nel formato richiesto
+static int writeout(driver& drv, const std::string& f, outkind kind) {
+  switch (kind) {
+  case OUT_LL:
+  case OUT_BC:
+    return drv.emit_ir(f, kind == OUT_BC);
+  case OUT_ASM:
+    return drv.emit(f, CGFT_AssemblyFile);
+  case OUT_OBJ:
+    return drv.emit(f, CGFT_ObjectFile);
+  default:
+    drv.module->print(errs(), nullptr);
+    return 0;
+  }
+}
+
+// Compilazione completa di un singolo file (modalità -j): ogni file ha un proprio
+// driver, e dunque un proprio LLVMContext, Module e IRBuilder, e produce un
+// proprio file di output, per cui può essere eseguita su un thread dedicato
+static int compileone(const driver& opts, const std::string& f, outkind kind) {
+  driver drv;
+  configure(drv, opts);
+  if (drv.inittarget() || drv.parse(f))
+    return 1;
+  drv.codegen();
+  if (drv.optimize())
+    return 1;
+  int res = writeout(drv, outname(f, kind), kind);
+  printreport(drv);
+  return res;
+}
+
+// Compilazione richiesta da una linea di comando (argv[0] è il nome del programma)
+static int compile(const std::vector<std::string>& argv) {
+  int argc = argv.size();
   int res = 0;
   driver drv;
+  std::vector<std::string> files;
+  std::string output;       // File di output (-o)
+  bool emitobj = false;     // Emissione di codice oggetto (-c)
+  bool emitasm = false;     // Emissione di codice assembly (-S)
+  bool emitll = false;      // Emissione di IR testuale in un file (-emit-llvm)
+  bool emitbc = false;      // Emissione di bitcode in un file (-emit-bc)
+  bool run = false;         // Esecuzione tramite JIT (--run)
+  bool repl = false;        // Sessione interattiva (--repl)
+  bool wholeprogram = false;    // Collegamento e ottimizzazione dell'intero programma (--whole-program)
+  std::string entry = "main";   // Funzione da eseguire (--entry)
+  std::vector<double> args;     // Argomenti della funzione da eseguire (--args)
+  unsigned jobs = 0;            // Numero di thread per la compilazione parallela (-j)
+  std::string reportfile;       // File in cui scrivere i report (-ftime-report-file=)
+  bool stats = false;           // Stampa delle statistiche dei passi LLVM (-stats)
   int i = 1;
+  // Le opzioni vengono raccolte prima della compilazione, in modo che valgano
+  // per tutti i file indipendentemente dalla posizione sulla linea di comando
   while (i<argc) {
-    if (argv[i] == std::string ("-p"))
+    std::string arg = argv[i];
+    if (arg == "-p")
       drv.trace_parsing = true; // Abilita tracce debug nel parser
-    else if (argv[i] == std::string ("-s"))
+    else if (arg == "-s")
       drv.trace_scanning = true;// Abilita tracce debug nello scanner
-    else  if (!drv.parse(argv[i])) { // Parsing e creazione dell'AST
-      drv.codegen();                 // Visita AST e generazione dell'IR (su stderr)
+    else if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '3')
+      drv.optlevel = arg[2] - '0';          // Livello di ottimizzazione
+    else if (arg.compare(0, 8, "-passes=") == 0)
+      drv.passes = arg.substr(8);           // Pipeline personalizzata, come in opt
+    else if (arg == "-ffast-math")
+      drv.fmf.setFast();                    // Tutte le ottimizzazioni floating point non IEEE
+    else if (arg == "-fno-fast-math")
+      drv.fmf.clear();
+    else if (arg == "-ffp-contract=fast")
+      drv.fmf.setAllowContract(true);       // Contrazione di mul+add in FMA
+    else if (arg == "-ffp-contract=off")
+      drv.fmf.setAllowContract(false);
+    else if (arg == "-fno-nans")
+      drv.fmf.setNoNaNs();                  // Gli operandi non sono mai NaN
+    else if (arg == "-fno-builtin")
+      drv.nobuiltin = true;                 // Nessuna funzione di libm trattata come intrinsic
+    else if (arg.compare(0, 9, "-fveclib=") == 0) {
+      auto lib = veclibs.find(arg.substr(9)); // Libreria per le chiamate vettorizzate
+      if (lib == veclibs.end()) {
+        std::cerr << "Libreria vettoriale sconosciuta: " << arg.substr(9) << std::endl;
+        return 1;
+      }
+      drv.veclib = lib->second;
+    }
+    else if (arg == "-fprofile-generate")
+      drv.pgo = PGOOptions::IRInstr;        // Strumentazione per la raccolta del profilo
+    else if (arg.compare(0, 19, "-fprofile-generate=") == 0) {
+      drv.pgo = PGOOptions::IRInstr;        // Profili scritti nella directory indicata
+      drv.profile = arg.substr(19) + "/default_%m.profraw";
+    }
+    else if (arg.compare(0, 14, "-fprofile-use=") == 0) {
+      drv.pgo = PGOOptions::IRUse;          // Ottimizzazione con il profilo raccolto
+      drv.profile = arg.substr(14);
+    }
+    else if (arg.compare(0, 13, "-finstrument=") == 0) {
+      std::stringstream kinds(arg.substr(13)); // Contatori di chiamate e cicli (runtime/libkrt.a)
+      std::string k;
+      while (std::getline(kinds, k, ',')) {
+        if (k == "calls")
+          drv.instrument_calls = true;
+        else if (k == "loops")
+          drv.instrument_loops = true;
+        else {
+          std::cerr << "Strumentazione sconosciuta: " << k << std::endl;
+          return 1;
+        }
+      }
+    }
+    else if (arg.compare(0, 12, "-fcache-dir=") == 0)
+      drv.cachedir = arg.substr(12);        // Cache della compilazione incrementale
+    else if (arg.compare(0, 6, "-mcpu=") == 0)
+      drv.cpu = arg.substr(6);              // CPU target
+    else if (arg == "-c")
+      emitobj = true;
+    else if (arg == "-S")
+      emitasm = true;
+    else if (arg == "-emit-llvm")
+      emitll = true;
+    else if (arg == "-emit-bc")
+      emitbc = true;
+    else if (arg == "-o" && i+1 < argc)
+      output = argv[++i];
+    else if (arg == "-j" && i+1 < argc)
+      jobs = std::max(1, atoi(argv[++i].c_str()));
+    else if (arg.size() > 2 && arg.compare(0, 2, "-j") == 0)
+      jobs = std::max(1, atoi(arg.c_str() + 2));
+    else if (arg.compare(0, 19, "-fparallel-codegen=") == 0)
+      drv.partitions = std::max(1, atoi(arg.c_str() + 19)); // Thread del backend per un modulo
+    else if (arg == "-ftime-report" || arg == "-ftime-report=text")
+      drv.time_report = true;
+    else if (arg == "-ftime-report=json")
+      drv.time_report = reportjson = true;
+    else if (arg.compare(0, 19, "-ftime-report-file=") == 0)
+      reportfile = arg.substr(19);
+    else if (arg == "-stats")
+      stats = true;
+    else if (arg == "--run")
+      run = true;
+    else if (arg == "--repl")
+      repl = true;
+    else if (arg == "--whole-program")
+      wholeprogram = true;
+    else if (arg == "--export" && i+1 < argc) {
+      // Entry point separati da virgole o spazi: --export f,g o --export "f g"
+      std::string list = argv[++i];
+      std::replace(list.begin(), list.end(), ',', ' ');
+      std::istringstream in(list);
+      std::string name;
+      while (in >> name)
+        drv.exports.push_back(name);
+    }
+    else if (arg == "--entry" && i+1 < argc)
+      entry = argv[++i];
+    else if (arg == "--args" && i+1 < argc) {
+      // Gli argomenti possono essere separati da virgole o spazi: --args 1,2 o --args "1 2"
+      std::string list = argv[++i];
+      std::replace(list.begin(), list.end(), ',', ' ');
+      std::istringstream in(list);
+      double a;
+      while (in >> a)
+        args.push_back(a);
+    }
+    else
+      files.push_back(arg);
+    i++;
+  };
+
+  // Se è richiesta un'ottimizzazione l'IR non può essere emesso man mano che viene
+  // generato: l'intero modulo viene ottimizzato ed emesso al termine della codegen
+  outkind kind = emitbc ? OUT_BC : emitll ? OUT_LL : emitobj ? OUT_OBJ :
+                 emitasm ? OUT_ASM : OUT_STREAM;
+  drv.stream_ir = drv.optlevel == 0 && drv.passes.empty() && kind == OUT_STREAM && !run &&
+                  !repl && !wholeprogram && drv.cachedir.empty() &&
+                  drv.pgo == PGOOptions::NoAction && !drv.instrument_calls && !drv.instrument_loops;
+  // Il codice strumentato va collegato al runtime dei profili (clang -fprofile-generate),
+  // che il JIT non fornisce; i profili non concorrono alla chiave della cache
+  if (drv.pgo == PGOOptions::IRInstr && (run || repl)) {
+    std::cerr << "-fprofile-generate non è compatibile con --run e --repl" << std::endl;
+    return 1;
+  }
+  // La chiave di una definizione non dipende dagli altri sorgenti, che con
+  // --whole-program possono definire funzioni di libm da non sostituire
+  if (wholeprogram && !drv.cachedir.empty()) {
+    std::cerr << "-fcache-dir non è compatibile con --whole-program" << std::endl;
+    return 1;
+  }
+  if (drv.pgo != PGOOptions::NoAction && !drv.cachedir.empty()) {
+    std::cerr << "-fcache-dir non è compatibile con -fprofile-generate e -fprofile-use" << std::endl;
+    return 1;
+  }
+  // Strumentazione e uso del profilo fanno parte delle pipeline di default
+  // (-O<n>): una pipeline indicata con -passes= li ignorerebbe
+  if (drv.pgo != PGOOptions::NoAction && !drv.passes.empty()) {
+    std::cerr << "-passes= non è compatibile con -fprofile-generate e -fprofile-use" << std::endl;
+    return 1;
+  }
+  if (drv.pgo == PGOOptions::IRUse && !sys::fs::exists(drv.profile)) {
+    std::cerr << "Profilo non trovato: " << drv.profile << std::endl;
+    return 1;
+  }
+  // Le parti emesse in parallelo vengono riunite in un solo file oggetto; i file
+  // assembly delle parti non si possono invece concatenare
+  if (drv.partitions > 1 && kind != OUT_OBJ) {
+    std::cerr << "-fparallel-codegen richiede -c" << std::endl;
+    return 1;
+  }
+  // Senza --export l'entry point del programma è main; con --run lo è anche
+  // la funzione da eseguire
+  if (wholeprogram) {
+    if (drv.exports.empty())
+      drv.exports.push_back("main");
+    if (run)
+      drv.exports.push_back(entry);
+  }
+  if (!drv.cachedir.empty() && !repl) {
+    if (std::error_code EC = sys::fs::create_directories(drv.cachedir)) {
+      std::cerr << "Impossibile creare " << drv.cachedir << ": " << EC.message() << std::endl;
+      return 1;
+    }
+  }
+
+  // Il target va inizializzato prima della codegen, perché triple e data layout
+  // devono essere noti sia all'IR generato sia alle ottimizzazioni
+  std::unique_ptr<raw_fd_ostream> reportfd;
+  if (!reportfile.empty()) {
+    std::error_code EC;
+    reportfd = std::make_unique<raw_fd_ostream>(reportfile, EC, sys::fs::OF_Text);
+    if (EC) {
+      std::cerr << "Impossibile aprire " << reportfile << ": " << EC.message() << std::endl;
+      return 1;
+    }
+    reportout = reportfd.get();
+  }
+  // Le statistiche dei passi sono raccolte solo da LLVM compilato con le
+  // asserzioni abilitate (o con LLVM_FORCE_ENABLE_STATS)
+  if (stats)
+    EnableStatistics(false);
+
+  // Con -j ogni file viene compilato indipendentemente dagli altri in un proprio
+  // file oggetto/assembly; i thread si spartiscono dinamicamente i file da compilare
+  if (jobs) {
+    if (kind == OUT_STREAM) {
+      std::cerr << "La compilazione parallela (-j) richiede -c, -S, -emit-llvm o -emit-bc" << std::endl;
+      return 1;
+    }
+    if (wholeprogram) {
+      std::cerr << "La compilazione parallela (-j) non è compatibile con --whole-program" << std::endl;
+      return 1;
+    }
+    // Ogni file ha il proprio output, con il nome derivato dal sorgente
+    if (!output.empty() || run || repl) {
+      std::cerr << "La compilazione parallela (-j) non è compatibile con -o, --run e --repl" << std::endl;
+      return 1;
+    }
+    std::atomic<size_t> next(0);
+    std::atomic<int> failed(0);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < std::min<size_t>(jobs, files.size()); t++)
+      workers.emplace_back([&] {
+        for (size_t k; (k = next++) < files.size(); )
+          if (compileone(drv, files[k], kind))
+            failed = 1;
+      });
+    for (auto &w : workers)
+      w.join();
+    if (stats)
+      reportjson ? PrintStatisticsJSON(*reportout) : PrintStatistics(*reportout);
+    return failed;
+  }
+
+  if (!drv.stream_ir && drv.inittarget())
+    return 1;
+  // Nella sessione interattiva i file vengono caricati prima di leggere stdin
+  if (repl)
+    return drv.repl(files);
+
+  for (auto &f : files) {
+    if (wholeprogram)    // Ogni sorgente in un proprio modulo
+      drv.beginunit();
+    if (!drv.parse(f)) { // Parsing e creazione dell'AST
+      drv.codegen();     // Visita AST e generazione dell'IR (su stderr)
     } else
       res = 1;
-    i++;
   };
+
+  if (!drv.stream_ir) {
+    if (res || (wholeprogram && drv.linkunits()) || drv.optimize())
+      return 1;
+    if (run)
+      res = drv.run(entry, args);
+    else {
+      // In assenza di -o il nome del file di output deriva da quello del primo sorgente
+      if (output.empty() && !files.empty())
+        output = outname(files[0], kind);
+      res = writeout(drv, output, kind);
+    }
+  }
+  printreport(drv);
+  if (stats)
+    reportjson ? PrintStatisticsJSON(*reportout) : PrintStatistics(*reportout);
   return res;
 }
+
+int main (int argc, char *argv[]) {
+  std::vector<std::string> args(argv, argv + argc);
+  // Con --server <socket> kcomp resta in attesa di richieste di compilazione,
+  // inviate da kclient o da kcomp --client <socket> <opzioni>, che vengono eseguite
+  // senza pagare ogni volta l'avvio del processo e l'inizializzazione del target
+  if (argc == 3 && args[1] == "--server") {
+    driver warm;
+    if (warm.inittarget())
+      return 1;
+    return serve(args[2], [](const std::vector<std::string>& request) {
+      int res = compile(request);
+      outs().flush();
+      errs().flush();
+      return res;
+    });
+  }
+  if (argc >= 3 && args[1] == "--client")
+    return client(args[2], std::vector<std::string>(args.begin() + 3, args.end()));
+  return compile(args);
+}
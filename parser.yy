@@ -15,6 +15,7 @@
   # include <string>
   # include <exception>
   class driver;
+  class Symbol;
   class RootAST;
   class ExprAST;
   class NumberExprAST;
@@ -29,6 +30,7 @@
   class AssignmentAST;
   class IfExprAST;
   class ForExprAST;
+  class PForExprAST;
   class BinaryExprAST;
   class LogicalExprAST;
 }
@@ -64,19 +66,23 @@
   ASSIGN     "="
   LBRACE     "{"
   RBRACE     "}"
+  LBRACKET   "["
+  RBRACKET   "]"
   EXTERN     "extern"
   DEF        "def"
   VAR        "var"
   GLOBAL     "global"
   IF         "if"
   FOR        "for"
+  PFOR       "pfor"
+  REDUCE     "reduce"
   ELSE       "else"
   NOT        "not"
   OR         "or"
   AND        "and"
 ;
 
-%token <std::string> IDENTIFIER "id"
+%token <const Symbol*> IDENTIFIER "id"
 %token <double> NUMBER "number"
 
 // definizioni dei tipi dei non terminali incontrati nelle produzioni
@@ -87,12 +93,13 @@
 %type <ExprAST*> relexp
 %type <std::vector<ExprAST*>> optexp
 %type <std::vector<ExprAST*>> explist
-%type <RootAST*> program
+%type <std::vector<RootAST*>> program
 %type <RootAST*> top
 %type <FunctionAST*> definition
 %type <PrototypeAST*> external
 %type <PrototypeAST*> proto
-%type <std::vector<std::string>> idseq
+%type <std::vector<std::pair<const Symbol*,bool>>> idseq
+%type <std::pair<const Symbol*,bool>> param
 %type <std::vector<VarBindingAST*>> vardefs
 %type <VarBindingAST*> binding
 %type <GlobalVariableAST*> globalvar
@@ -103,6 +110,8 @@
 %type <ExprAST*> initexp
 %type <IfExprAST*> ifstmt
 %type <ForExprAST*> forstmt
+%type <PForExprAST*> pforstmt
+%type <std::pair<char,const Symbol*>> reduction
 %type <RootAST*> init
 
 // PRODUZIONI
@@ -111,34 +120,57 @@
 %start startsymb;
 
 startsymb:
-program                 { drv.root = $1; }
+program                 { drv.root = drv.make<SeqAST>(std::move($1)); }
 
+// Le liste sono ricorsive a sinistra: il parser riduce ogni elemento appena letto
+// (stack di profondità costante) e lo accoda al vettore in tempo costante.
+// I vettori vengono spostati e non copiati, per non tornare a un costo quadratico
 program:
-  %empty                { $$ = new SeqAST(nullptr,nullptr); }
-|  top ";" program      { $$ = new SeqAST($1,$3); };
+  %empty                { }
+| program top ";"       { $$ = std::move($1);
+                          if ($2) {
+                            $$.push_back($2);
+                            if (!drv.cachedir.empty()) // Sorgente della definizione (chiave della cache)
+                              drv.define($2, @2);
+                          } };
 
 top:
   %empty                { $$ = nullptr; }
 | definition            { $$ = $1; }
 | external              { $$ = $1; }
-| globalvar		          { $$ = $1; };
+| globalvar		          { $$ = $1; }
+// Nella sessione interattiva (--repl) un'istruzione può comparire a livello
+// top-level: diventa il corpo di una funzione anonima, eseguita appena generata
+| stmt                  { if (!drv.jit) {
+                            error(@1, "Istruzioni top-level ammesse solo con --repl");
+                            YYERROR;
+                          }
+                          PrototypeAST* anon = drv.make<PrototypeAST>(drv.intern("__anon_expr"),
+                                                 std::vector<std::pair<const Symbol*,bool>>());
+                          anon->noemit();
+                          $$ = drv.make<FunctionAST>(anon,$1,@1); };
 
 definition:
-  "def" proto block     { $$ = new FunctionAST($2,$3); $2->noemit(); };
+  "def" proto block     { $$ = drv.make<FunctionAST>($2,$3,@1); $2->noemit(); };
 
 external:
   "extern" proto        { $$ = $2; };
 
 proto:
-  "id" "(" idseq ")"    { $$ = new PrototypeAST($1,$3);  };
+  "id" "(" idseq ")"    { $$ = drv.make<PrototypeAST>($1,std::move($3));  };
   
 globalvar:
-  "global" "id"         { $$ = new GlobalVariableAST($2); };
+  "global" "id"                   { $$ = drv.make<GlobalVariableAST>($2); }
+| "global" "id" "[" "number" "]"  { $$ = drv.make<GlobalVariableAST>($2,$4); };
 
 idseq:
-  %empty                { std::vector<std::string> args;
-                          $$ = args; }
-| "id" idseq            { $2.insert($2.begin(),$1); $$ = $2; };
+  %empty                { }
+| idseq param           { $$ = std::move($1); $$.push_back($2); };
+
+// Un parametro seguito da [] è un array, passato per indirizzo
+param:
+  "id"                  { $$ = std::make_pair($1,false); }
+| "id" "[" "]"          { $$ = std::make_pair($1,true); };
 
 %left ":";
 %left "and" "or";
@@ -148,62 +180,74 @@ idseq:
 %left "*" "/";
 
 stmts:
-  stmt			      { std::vector<ExprAST*> statements;
-                    statements.push_back($1);
-			              $$ = statements;
-                  }
-| stmt ";" stmts	{ $3.insert($3.begin(), $1); $$ = $3; };
+  stmt			      { $$.push_back($1); }
+| stmts ";" stmt	{ $$ = std::move($1); $$.push_back($3); };
 
 stmt:
   assignment		{ $$ = $1; }
 | block			    { $$ = $1; }
 | ifstmt			  { $$ = $1; }
 | forstmt			  { $$ = $1; }
+| pforstmt			{ $$ = $1; }
 | exp			      { $$ = $1; };
 
 ifstmt:
   "if" "(" condexp ")" stmt                 { ExprAST* NullExpr;
-                                              $$ = new IfExprAST($3,$5,NullExpr); }
-| "if" "(" condexp ")" stmt "else" stmt     { $$ = new IfExprAST($3,$5,$7); };
+                                              $$ = drv.make<IfExprAST>($3,$5,NullExpr); }
+| "if" "(" condexp ")" stmt "else" stmt     { $$ = drv.make<IfExprAST>($3,$5,$7); };
 
 forstmt:
-  "for" "(" init ";" condexp ";" assignment ")" stmt   { $$ = new ForExprAST($3,$5,$7,$9); };
+  "for" "(" init ";" condexp ";" assignment ")" stmt   { $$ = drv.make<ForExprAST>($3,$5,$7,$9,@1); };
+
+// Il ciclo parallelo ha una forma fissa, in modo che il numero di iterazioni sia
+// noto prima di iniziare: la stessa variabile compare nei tre elementi dell'intestazione
+pforstmt:
+  "pfor" "(" "var" "id" "=" exp ";" "id" "<" exp ";" "+" "+" "id" ")" reduction stmt
+                        { if ($8 != $4 || $14 != $4) {
+                            error(@8, "pfor richiede la stessa variabile in inizializzazione, test e incremento");
+                            YYERROR;
+                          }
+                          $$ = drv.make<PForExprAST>($4,$6,$10,$17,$16.first,$16.second); };
+
+reduction:
+  %empty                      { $$ = std::make_pair('\0', (const Symbol*)nullptr); }
+| "reduce" "(" "+" ":" "id" ")" { $$ = std::make_pair('+', $5); }
+| "reduce" "(" "*" ":" "id" ")" { $$ = std::make_pair('*', $5); };
 
 init:
   binding       { $$ = $1; }
 | assignment    { $$ = $1; };
 
 assignment:
-  "id" "=" exp		{ $$ = new AssignmentAST($1,$3); }
-| "+" "+" "id"    { ExprAST* Inc = new NumberExprAST(1.0); 
-                    ExprAST* Reg = new VariableExprAST($3);
-                    ExprAST* Res = new BinaryExprAST('+',Reg,Inc); 
-                    $$ = new AssignmentAST($3,Res);
+  "id" "=" exp		{ $$ = drv.make<AssignmentAST>($1,$3); }
+| "id" "[" exp "]" "=" exp  { $$ = drv.make<AssignmentAST>($1,$6,$3); }
+| "+" "+" "id"    { ExprAST* Inc = drv.make<NumberExprAST>(1.0); 
+                    ExprAST* Reg = drv.make<VariableExprAST>($3);
+                    ExprAST* Res = drv.make<BinaryExprAST>('+',Reg,Inc); 
+                    $$ = drv.make<AssignmentAST>($3,Res);
                   };
 
 block:
   "{" stmts "}"			{ std::vector<VarBindingAST*> VNull;
-                      $$ = new BlockExprAST(VNull, $2); }
-| "{" vardefs ";" stmts "}"	{ $$ = new BlockExprAST($2,$4); };
+                      $$ = drv.make<BlockExprAST>(VNull, std::move($2)); }
+| "{" vardefs ";" stmts "}"	{ $$ = drv.make<BlockExprAST>(std::move($2),std::move($4)); };
 
 vardefs:
-  binding                 { std::vector<VarBindingAST*> definitions;
-                            definitions.push_back($1);
-                            $$ = definitions; }
-| vardefs ";" binding     { $1.push_back($3);
-                            $$ = $1; };
+  binding                 { $$.push_back($1); }
+| vardefs ";" binding     { $$ = std::move($1); $$.push_back($3); };
 
 binding:
-  "var" "id" initexp  	{ $$ = new VarBindingAST($2,$3); };
+  "var" "id" initexp  	{ $$ = drv.make<VarBindingAST>($2,$3); }
+| "var" "id" "[" exp "]"  { $$ = drv.make<VarBindingAST>($2,nullptr,$4); };
 
 exp:
-  exp "+" exp           { $$ = new BinaryExprAST('+',$1,$3); }
-| exp "-" exp           { $$ = new BinaryExprAST('-',$1,$3); }
-| exp "*" exp           { $$ = new BinaryExprAST('*',$1,$3); }
-| exp "/" exp           { $$ = new BinaryExprAST('/',$1,$3); }
+  exp "+" exp           { $$ = drv.make<BinaryExprAST>('+',$1,$3); }
+| exp "-" exp           { $$ = drv.make<BinaryExprAST>('-',$1,$3); }
+| exp "*" exp           { $$ = drv.make<BinaryExprAST>('*',$1,$3); }
+| exp "/" exp           { $$ = drv.make<BinaryExprAST>('/',$1,$3); }
 | idexp                 { $$ = $1; }
 | "(" exp ")"           { $$ = $2; }
-| "number"              { $$ = new NumberExprAST($1); }
+| "number"              { $$ = drv.make<NumberExprAST>($1); }
 | expif                 { $$ = $1; };
 
 initexp:
@@ -212,36 +256,35 @@ initexp:
 
 %right "?" "else" RPAREN;
 expif:
-  condexp "?" exp ":" exp { $$ = new IfExprAST($1,$3,$5); };
+  condexp "?" exp ":" exp { $$ = drv.make<IfExprAST>($1,$3,$5); };
   
 condexp:
   relexp                { $$ = $1; }
-| relexp "and" condexp  { $$ = new LogicalExprAST("and",$1,$3); }
-| relexp "or" condexp   { $$ = new LogicalExprAST("or",$1,$3); }
+| relexp "and" condexp  { $$ = drv.make<LogicalExprAST>("and",$1,$3); }
+| relexp "or" condexp   { $$ = drv.make<LogicalExprAST>("or",$1,$3); }
 | "not" condexp         { ExprAST* NullExp;
-                          $$ = new LogicalExprAST("not",$2,NullExp); }
+                          $$ = drv.make<LogicalExprAST>("not",$2,NullExp); }
 | "(" condexp ")"       { $$ = $2; };
 
 relexp:
-  exp "<" exp           { $$ = new BinaryExprAST('<',$1,$3); }
-| exp "==" exp          { $$ = new BinaryExprAST('=',$1,$3); };
+  exp "<" exp           { $$ = drv.make<BinaryExprAST>('<',$1,$3); }
+| exp "==" exp          { $$ = drv.make<BinaryExprAST>('=',$1,$3); };
 
 idexp:
-  "id"                  { $$ = new VariableExprAST($1); }
-| "-" "id"              { $$ = new BinaryExprAST('*', new NumberExprAST(-1.0), new VariableExprAST($2)); }
-| "id" "(" optexp ")"   { $$ = new CallExprAST($1,$3); };
+  "id"                  { $$ = drv.make<VariableExprAST>($1); }
+| "-" "id"              { $$ = drv.make<BinaryExprAST>('*', drv.make<NumberExprAST>(-1.0), drv.make<VariableExprAST>($2)); }
+| "id" "(" optexp ")"   { $$ = drv.make<CallExprAST>($1,std::move($3)); }
+| "id" "[" exp "]"      { $$ = drv.make<VariableExprAST>($1,$3); }
+| "-" "id" "[" exp "]"  { $$ = drv.make<BinaryExprAST>('*', drv.make<NumberExprAST>(-1.0), drv.make<VariableExprAST>($2,$4)); };
 
 optexp:
   %empty                { std::vector<ExprAST*> args;
 			 $$ = args; }
-| explist               { $$ = $1; };
+| explist               { $$ = std::move($1); };
 
 explist:
-  exp                   { std::vector<ExprAST*> args;
-                         args.push_back($1);
-			 $$ = args;
-                        }
-| exp "," explist       { $3.insert($3.begin(), $1); $$ = $3; };
+  exp                   { $$.push_back($1); }
+| explist "," exp       { $$ = std::move($1); $$.push_back($3); };
 
 // FUNZIONI AUSILIARIE
 %%
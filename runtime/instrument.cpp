@@ -0,0 +1,167 @@
+#include "krt.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/***************************** Strumentazione *****************************/
+// Contatori delle funzioni e dei cicli strumentati da kcomp -finstrument=. I
+// contatori sono nei record del runtime, uno per sito, e non nelle variabili del
+// codice generato, che con --run e --repl viene liberato prima dell'uscita dal
+// processo; sono aggiornati in modo atomico, perché le stesse funzioni possono
+// essere eseguite dai thread di un pfor. Lo stack delle attivazioni, da cui si
+// ricavano i cicli propri di ogni funzione, è invece di ogni thread
+
+namespace {
+
+// Contatore dei cicli del processore; in mancanza, il tempo in nanosecondi
+uint64_t cycles() {
+#if defined(__clang__)
+  return __builtin_readcyclecounter();
+#elif defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+void add(uint64_t& counter, uint64_t value) {
+  __atomic_fetch_add(&counter, value, __ATOMIC_RELAXED);
+}
+
+// Copia di un sito, con i suoi contatori
+struct Record {
+  std::string name;
+  std::string loc;
+  int32_t kind;
+  uint64_t count = 0;   // Chiamate della funzione o esecuzioni del ciclo
+  uint64_t total = 0;   // Cicli di clock della funzione o iterazioni del ciclo
+  uint64_t self = 0;    // Cicli di clock della funzione, escluse le funzioni chiamate
+};
+
+// Attivazione di una funzione strumentata. Il totale di una funzione ricorsiva è
+// misurato solo sull'attivazione più esterna, per non contare più volte gli stessi
+// cicli; quelli propri sono invece di ogni attivazione
+struct Frame {
+  Record* record;
+  uint64_t start;       // Cicli all'ingresso
+  uint64_t child;       // Cicli trascorsi nelle funzioni chiamate
+  bool outer;           // Attivazione più esterna della funzione nel thread
+};
+
+thread_local std::vector<Frame> frames;
+thread_local std::unordered_map<Record*, unsigned> depth; // Attivazioni in corso
+
+// Record dei siti eseguiti almeno una volta. Il rapporto viene scritto dal
+// distruttore, cioè all'uscita dal processo, su stderr o nel file indicato da
+// KRT_INSTRUMENT_FILE
+class Registry {
+public:
+  ~Registry();
+  Record* add(krt_site* site);
+
+private:
+  std::mutex lock;
+  std::vector<std::unique_ptr<Record>> records;
+};
+
+Record* Registry::add(krt_site* site) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (void* r = __atomic_load_n(&site->record, __ATOMIC_ACQUIRE))
+    return static_cast<Record*>(r);
+  records.push_back(std::make_unique<Record>());
+  Record* r = records.back().get();
+  r->name = site->name;
+  r->loc = site->loc;
+  r->kind = site->kind;
+  __atomic_store_n(&site->record, static_cast<void*>(r), __ATOMIC_RELEASE);
+  return r;
+}
+
+// Funzioni in ordine decrescente di cicli propri, cicli in ordine decrescente di
+// iterazioni
+Registry::~Registry() {
+  std::lock_guard<std::mutex> guard(lock);
+  if (records.empty())
+    return;
+  std::vector<Record*> funcs, loops;
+  for (auto &r : records)
+    (r->kind == 'f' ? funcs : loops).push_back(r.get());
+  std::sort(funcs.begin(), funcs.end(),
+            [](Record* a, Record* b) { return a->self > b->self; });
+  std::sort(loops.begin(), loops.end(),
+            [](Record* a, Record* b) { return a->total > b->total; });
+
+  const char* path = getenv("KRT_INSTRUMENT_FILE");
+  FILE* out = path ? fopen(path, "w") : stderr;
+  if (!out)
+    return;
+  if (!funcs.empty()) {
+    fprintf(out, "%12s %16s %16s  %-20s %s\n", "chiamate", "cicli totali", "cicli propri",
+            "funzione", "posizione");
+    for (Record* r : funcs)
+      fprintf(out, "%12" PRIu64 " %16" PRIu64 " %16" PRIu64 "  %-20s %s\n",
+              r->count, r->total, r->self, r->name.c_str(), r->loc.c_str());
+  }
+  if (!loops.empty()) {
+    fprintf(out, "%s%12s %16s %16s  %-20s %s\n", funcs.empty() ? "" : "\n", "esecuzioni",
+            "iterazioni", "media", "funzione", "posizione");
+    for (Record* r : loops)
+      fprintf(out, "%12" PRIu64 " %16" PRIu64 " %16.1f  %-20s %s\n", r->count, r->total,
+              r->count ? (double)r->total / r->count : 0.0, r->name.c_str(), r->loc.c_str());
+  }
+  if (out != stderr)
+    fclose(out);
+}
+
+Registry registry;
+
+// La registrazione avviene alla prima esecuzione del sito: il puntatore al record
+// evita di acquisire il lock nelle esecuzioni successive
+Record* record(krt_site* site) {
+  if (void* r = __atomic_load_n(&site->record, __ATOMIC_ACQUIRE))
+    return static_cast<Record*>(r);
+  return registry.add(site);
+}
+
+} // namespace
+
+/****************************** Interfaccia C ******************************/
+extern "C" void __krt_enter(krt_site* site) {
+  Record* r = record(site);
+  add(r->count, 1);
+  bool outer = depth[r]++ == 0;
+  frames.push_back({r, cycles(), 0, outer});
+}
+
+extern "C" void __krt_exit(krt_site* site) {
+  uint64_t now = cycles();
+  // Le uscite corrispondono sempre all'ultimo ingresso: il codice generato
+  // chiama __krt_exit prima di ogni ret della funzione
+  Record* r = static_cast<Record*>(__atomic_load_n(&site->record, __ATOMIC_ACQUIRE));
+  if (frames.empty() || frames.back().record != r)
+    return;
+  Frame f = frames.back();
+  frames.pop_back();
+  uint64_t elapsed = now - f.start;
+  add(r->self, elapsed - std::min(elapsed, f.child));
+  if (f.outer)
+    add(r->total, elapsed);
+  depth[r]--;
+  if (!frames.empty())
+    frames.back().child += elapsed;
+}
+
+extern "C" void __krt_loop(krt_site* site, int64_t trips) {
+  Record* r = record(site);
+  add(r->count, 1);
+  add(r->total, trips);
+}
@@ -0,0 +1,195 @@
+#include "krt.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/******************************* Thread pool *******************************/
+// Ogni thread (il chiamante è il thread 0) possiede un intervallo di iterazioni:
+// preleva dall'inizio blocchi di dimensione grain e, esaurito il proprio, ruba
+// la metà finale dell'intervallo di un altro thread. La distribuzione iniziale è
+// uniforme; il furto riequilibra il carico quando le iterazioni hanno costi diversi
+
+namespace {
+
+// Intervallo [begin, end) ancora da eseguire di un thread
+struct Range {
+  std::mutex lock;
+  int64_t begin = 0;
+  int64_t end = 0;
+};
+
+// Elemento neutro dell'operatore di riduzione
+double identity(int op) {
+  return op == '*' ? 1.0 : 0.0;
+}
+
+double combine(int op, double a, double b) {
+  return op == '*' ? a * b : op == '+' ? a + b : a;
+}
+
+// Vero nei thread del pool e nel chiamante durante un pfor: un pfor annidato
+// (es. in una funzione chiamata dal corpo) viene eseguito sequenzialmente
+thread_local bool inside = false;
+
+class Pool {
+public:
+  Pool();
+  ~Pool();
+  double run(krt_body body, void* env, int64_t n, int op);
+
+private:
+  void loop(unsigned id);    // Ciclo di vita di un thread del pool
+  void work(unsigned id);    // Esecuzione della propria parte del pfor corrente
+  bool take(unsigned id, int64_t& begin, int64_t& end);
+  bool steal(unsigned id);
+
+  unsigned size;                      // Numero di thread, incluso il chiamante
+  std::vector<std::thread> threads;
+  std::unique_ptr<Range[]> ranges;
+  std::vector<double> partials;       // Risultato parziale della riduzione per thread
+
+  std::mutex jobs;                    // Serializza i pfor avviati da thread diversi
+  std::mutex lock;                    // Protegge lo stato seguente
+  std::condition_variable start, done;
+  unsigned generation = 0;            // Incrementato ad ogni nuovo pfor
+  unsigned active = 0;                // Thread del pool che non hanno ancora terminato
+  bool stop = false;
+
+  // pfor corrente
+  krt_body body = nullptr;
+  void* env = nullptr;
+  int op = 0;
+  int64_t grain = 1;
+};
+
+// Il numero di thread è quello dei core disponibili, oppure KRT_NUM_THREADS
+Pool::Pool() {
+  // Un valore non positivo (o non numerico) di KRT_NUM_THREADS viene ignorato
+  const char* env = getenv("KRT_NUM_THREADS");
+  long n = env ? strtol(env, nullptr, 10) : 0;
+  size = n > 0 ? n : std::thread::hardware_concurrency();
+  size = std::max(1u, size);
+  ranges.reset(new Range[size]);
+  partials.resize(size);
+  for (unsigned id = 1; id < size; id++)
+    threads.emplace_back(&Pool::loop, this, id);
+}
+
+Pool::~Pool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = true;
+  }
+  start.notify_all();
+  for (auto &t : threads)
+    t.join();
+}
+
+void Pool::loop(unsigned id) {
+  inside = true;
+  unsigned seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      start.wait(guard, [&] { return stop || generation != seen; });
+      if (stop)
+        return;
+      seen = generation;
+    }
+    work(id);
+    std::lock_guard<std::mutex> guard(lock);
+    if (--active == 0)
+      done.notify_one();
+  }
+}
+
+bool Pool::take(unsigned id, int64_t& begin, int64_t& end) {
+  std::lock_guard<std::mutex> guard(ranges[id].lock);
+  if (ranges[id].begin >= ranges[id].end)
+    return false;
+  begin = ranges[id].begin;
+  end = std::min(ranges[id].end, begin + grain);
+  ranges[id].begin = end;
+  return true;
+}
+
+// Cerca, a partire dal thread successivo, un intervallo non vuoto e ne sottrae
+// la metà finale (o tutto, se non supera un blocco), che diventa il proprio
+bool Pool::steal(unsigned id) {
+  for (unsigned k = 1; k < size; k++) {
+    Range& victim = ranges[(id + k) % size];
+    int64_t begin, end;
+    {
+      std::lock_guard<std::mutex> guard(victim.lock);
+      int64_t left = victim.end - victim.begin;
+      if (left <= 0)
+        continue;
+      begin = left <= grain ? victim.begin : victim.begin + left / 2;
+      end = victim.end;
+      victim.end = begin;
+    }
+    std::lock_guard<std::mutex> guard(ranges[id].lock);
+    ranges[id].begin = begin;
+    ranges[id].end = end;
+    return true;
+  }
+  return false;
+}
+
+void Pool::work(unsigned id) {
+  double partial = identity(op);
+  int64_t begin, end;
+  while (take(id, begin, end) || (steal(id) && take(id, begin, end)))
+    body(env, begin, end, &partial);
+  partials[id] = partial;
+}
+
+double Pool::run(krt_body body, void* env, int64_t n, int op) {
+  std::lock_guard<std::mutex> serial(jobs);
+  this->body = body;
+  this->env = env;
+  this->op = op;
+  // Blocchi abbastanza piccoli da bilanciare il carico (circa 16 per thread),
+  // ma non tanto da rendere significativo il costo della chiamata al corpo
+  grain = std::max<int64_t>(1, n / (16 * (int64_t)size));
+  for (unsigned id = 0; id < size; id++) {
+    ranges[id].begin = n * id / size;
+    ranges[id].end = n * (id + 1) / size;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    active = size - 1;
+    generation++;
+  }
+  start.notify_all();
+
+  inside = true;
+  work(0);
+  inside = false;
+
+  std::unique_lock<std::mutex> guard(lock);
+  done.wait(guard, [&] { return active == 0; });
+  double result = identity(op);
+  for (unsigned id = 0; id < size; id++)
+    result = combine(op, result, partials[id]);
+  return result;
+}
+
+} // namespace
+
+/****************************** Interfaccia C ******************************/
+extern "C" double __krt_pfor(krt_body body, void* env, int64_t n, int32_t op) {
+  if (n <= 0)
+    return identity(op);
+  static Pool pool;
+  if (inside || n == 1) {
+    double partial = identity(op);
+    body(env, 0, n, &partial);
+    return partial;
+  }
+  return pool.run(body, env, n, op);
+}
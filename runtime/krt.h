@@ -0,0 +1,40 @@
+#ifndef KRT_H
+#define KRT_H
+// Runtime del linguaggio Kaleidoscope: funzioni invocate dal codice generato da
+// kcomp. Il codice oggetto che usa pfor o che è strumentato (-finstrument=) va
+// collegato con libkrt.a (e -lpthread)
+#include <cstdint>
+
+extern "C" {
+
+// Corpo di un ciclo pfor, generato da kcomp: esegue le iterazioni [begin, end)
+// usando le variabili catturate in env e accumula la riduzione in *partial
+typedef void (*krt_body)(void* env, int64_t begin, int64_t end, double* partial);
+
+// Esegue in parallelo le iterazioni [0, n) del corpo body. op è l'operatore di
+// riduzione ('+', '*' o 0): ogni thread parte dall'elemento neutro e il risultato
+// è la combinazione dei valori parziali di tutti i thread
+double __krt_pfor(krt_body body, void* env, int64_t n, int32_t op);
+
+// Sito strumentato da kcomp -finstrument=: una funzione o un ciclo for. Il codice
+// generato contiene una variabile per sito; alla prima esecuzione il runtime copia
+// nome e posizione in un proprio record, che contiene i contatori e sopravvive al
+// codice (es. quello eseguito dal JIT), e all'uscita dal processo scrive il rapporto
+struct krt_site {
+  const char* name;     // Funzione (per un ciclo, quella che lo contiene)
+  const char* loc;      // Posizione nel sorgente (file:riga.colonna)
+  int32_t kind;         // 'f' per una funzione, 'l' per un ciclo
+  void* record;         // Record del runtime, nullptr finché il sito non è registrato
+};
+
+// Ingresso in una funzione strumentata e uscita (prima del ret o della chiamata
+// di coda con cui termina)
+void __krt_enter(krt_site* site);
+void __krt_exit(krt_site* site);
+
+// Fine di un'esecuzione di un ciclo strumentato, dopo trips iterazioni
+void __krt_loop(krt_site* site, int64_t trips);
+
+}
+
+#endif // ! KRT_H
@@ -4,11 +4,23 @@
 # include <cstdlib>
 # include <string>
 # include <cmath>
+# include <fcntl.h>
+# include <iostream>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
 # include "driver.hpp"
 # include "parser.hpp"
+
+// Lo scanner è rientrante, così che più driver possano analizzare file diversi
+// in parallelo: lo stato di flex è in drv.scanner e la funzione generata riceve
+// esplicitamente il relativo handle. yylex, invocata dal parser, fa da tramite
+# undef YY_DECL
+# define YY_DECL \
+  static yy::parser::symbol_type yylex_r (driver& drv, void* yyscanner)
 %}
 
-%option noyywrap nounput batch debug noinput
+%option noyywrap nounput batch debug noinput reentrant
 
 id      [a-zA-Z][a-zA-Z_0-9]*
 fpnum   [0-9]*\.?[0-9]+([eE][-+]?[0-9]+)?
@@ -49,12 +61,15 @@ blank   [ \t]
 "="      return yy::parser::make_ASSIGN    (loc);
 "{"      return yy::parser::make_LBRACE    (loc);
 "}"      return yy::parser::make_RBRACE    (loc);
+"["      return yy::parser::make_LBRACKET  (loc);
+"]"      return yy::parser::make_RBRACKET  (loc);
 
 {num}    { errno = 0;
            double n = strtod(yytext, NULL);
-           if (! (n!=HUGE_VAL && n!=-HUGE_VAL && errno != ERANGE))
-           throw yy::parser::syntax_error (loc, "Float value is out of range: "
-                      + std::string(yytext));
+           if (! (n!=HUGE_VAL && n!=-HUGE_VAL && errno != ERANGE)) {
+             drv.error(loc, "Float value is out of range: " + std::string(yytext));
+             return yy::parser::make_YYerror(loc);
+           }
            return yy::parser::make_NUMBER(n, loc);
          }
          
@@ -64,15 +79,17 @@ blank   [ \t]
 "global" { return yy::parser::make_GLOBAL(loc); }
 "if"     { return yy::parser::make_IF(loc); }
 "for"    { return yy::parser::make_FOR(loc); }
+"pfor"   { return yy::parser::make_PFOR(loc); }
+"reduce" { return yy::parser::make_REDUCE(loc); }
 "else"   { return yy::parser::make_ELSE(loc); }
 "not"    { return yy::parser::make_NOT(loc); }
 "or"     { return yy::parser::make_OR(loc); }
 "and"    { return yy::parser::make_AND(loc); }
 
-{id}     { return yy::parser::make_IDENTIFIER (yytext, loc); }
+{id}     { return yy::parser::make_IDENTIFIER (drv.intern(StringRef(yytext, yyleng)), loc); }
 
-.        { throw yy::parser::syntax_error
-               (loc, "invalid character: " + std::string(yytext));
+.        { drv.error(loc, "invalid character: " + std::string(yytext));
+           return yy::parser::make_YYerror(loc);
          }
          
 <<EOF>>  { return yy::parser::make_END (loc); }
@@ -80,19 +97,89 @@ blank   [ \t]
 
 %%
 
-void driver::scan_begin () {
-  yy_flex_debug = trace_scanning;
-  if (file.empty () || file == "-")
-    yyin = stdin;
-  else if (!(yyin = fopen (file.c_str (), "r")))
-    {
-      std::cerr << "cannot open " << file << ": " << strerror(errno) << '\n';
-      exit (EXIT_FAILURE);
-    }
+yy::parser::symbol_type yylex (driver& drv) {
+  return yylex_r (drv, drv.scanner);
+}
+
+// Il sorgente non viene letto attraverso yyin (e dunque copiato nel buffer di flex)
+// ma analizzato direttamente in memoria con yy_scan_buffer. Flex richiede che il
+// buffer termini con due caratteri nulli e lo modifica temporaneamente durante
+// l'analisi: il file viene quindi mappato privatamente (copy-on-write) in una regione
+// di almeno length+2 byte, i cui byte oltre la fine del file sono garantiti nulli
+bool driver::scan_begin () {
+  if (!buffer) {
+    if (file.empty () || file == "-")
+      {
+        // Lo standard input non è mappabile: viene letto per intero in source
+        std::string text;
+        char chunk[65536];
+        size_t n;
+        while ((n = fread (chunk, 1, sizeof chunk, stdin)) > 0)
+          text.append (chunk, n);
+        length = text.size ();
+        source = std::move (text);
+        source.append (2, '\0');
+        buffer = &source[0];
+      }
+    else
+      {
+        int fd = open (file.c_str (), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat (fd, &st) < 0)
+          {
+            std::cerr << "cannot open " << file << ": " << strerror(errno) << '\n';
+            if (fd >= 0)
+              close (fd);
+            return false;
+          }
+        length = st.st_size;
+        size_t page = sysconf (_SC_PAGESIZE);
+        mapped = (length + 2 + page - 1) / page * page;
+        // Una regione anonima (azzerata) garantisce i terminatori anche quando il
+        // file occupa interamente la sua ultima pagina; il file vi viene poi
+        // mappato sopra, a partire dall'inizio
+        void* base = mmap (nullptr, mapped, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base != MAP_FAILED && length > 0
+            && mmap (base, length, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+          {
+            munmap (base, mapped);
+            base = MAP_FAILED;
+          }
+        close (fd);
+        if (base == MAP_FAILED)
+          {
+            std::cerr << "cannot map " << file << ": " << strerror(errno) << '\n';
+            mapped = 0;
+            return false;
+          }
+        buffer = static_cast<char*> (base);
+      }
+  }
+  yylex_init (&scanner);
+  yyset_debug (trace_scanning, scanner);
+  yy_scan_buffer (buffer, length + 2, scanner);
+  return true;
 }
 
 void
 driver::scan_end ()
 {
-  fclose (yyin);
+  yylex_destroy (scanner);
+  if (mapped)
+    munmap (buffer, mapped);
+  else
+    source.clear ();
+  buffer = nullptr;
+  length = mapped = 0;
+}
+
+// Gli errori lessicali sono segnalati come quelli del parser, a cui lo scanner
+// restituisce poi il token YYerror: il parser (compilato senza eccezioni) termina
+// il parsing con un errore, senza che l'intero processo (es. il REPL) venga chiuso
+void
+driver::error (const yy::location& l, const std::string& m)
+{
+  std::cerr << l << ": " << m << '\n';
 }
@@ -0,0 +1,203 @@
+#include "server.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/******************************* Protocollo *******************************/
+// Richiesta: il numero dei campi in testo, seguito da '\n', e i campi, ciascuno
+// terminato da '\0': la directory corrente del client e i suoi argomenti. Al primo
+// byte sono associati (SCM_RIGHTS) i descrittori 0, 1 e 2 del client.
+// Risposta: un byte con il codice di uscita; se il processo che esegue la richiesta
+// termina in modo anomalo il client riceve solo la chiusura della connessione
+
+// Indirizzo del socket Unix, false se il percorso è troppo lungo
+static bool address(const std::string& path, sockaddr_un& addr) {
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof addr.sun_path) {
+    std::cerr << "Percorso del socket troppo lungo: " << path << std::endl;
+    return false;
+  }
+  strcpy(addr.sun_path, path.c_str());
+  return true;
+}
+
+// Scrive interamente il buffer, anche se il socket ne accetta una parte per volta
+static bool writeall(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Numero di campi completi (terminati da '\0') della richiesta ricevuta finora,
+// -1 se l'intestazione non è ancora arrivata
+static long fields(const std::string& msg, size_t& start) {
+  size_t nl = msg.find('\n');
+  if (nl == std::string::npos)
+    return -1;
+  start = nl + 1;
+  return std::count(msg.begin() + start, msg.end(), '\0');
+}
+
+/********************************* Server *********************************/
+// Esecuzione di una richiesta, nel processo figlio: i descrittori del client
+// diventano stdin, stdout e stderr, per cui la diagnostica (std::cerr, errs())
+// e l'output di --run gli arrivano direttamente
+static int request(int conn, compilefn compile) {
+  std::string msg;
+  int fds[3] = { -1, -1, -1 };
+  char buf[4096];
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof fds)];
+  iovec iov = { buf, sizeof buf };
+  msghdr mh = {};
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = control;
+  mh.msg_controllen = sizeof control;
+  ssize_t n = recvmsg(conn, &mh, 0);
+  if (n <= 0)
+    return 1;
+  for (cmsghdr *c = CMSG_FIRSTHDR(&mh); c; c = CMSG_NXTHDR(&mh, c))
+    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS &&
+        c->cmsg_len == CMSG_LEN(sizeof fds))
+      memcpy(fds, CMSG_DATA(c), sizeof fds);
+  if (fds[0] < 0)
+    return 1;
+  msg.append(buf, n);
+
+  // Il resto della richiesta segue sulla connessione
+  size_t start;
+  long count;
+  while ((count = fields(msg, start)) < 0 || count < atol(msg.c_str())) {
+    n = read(conn, buf, sizeof buf);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return 1;
+    msg.append(buf, n);
+  }
+  std::vector<std::string> args = { "kcomp" };
+  std::string cwd = msg.c_str() + start;
+  for (size_t p = start + cwd.size() + 1; p < msg.size(); p += args.back().size() + 1)
+    args.push_back(msg.c_str() + p);
+
+  for (int i = 0; i < 3; i++) {
+    dup2(fds[i], i);
+    close(fds[i]);
+  }
+  int res = 1;
+  if (chdir(cwd.c_str()) < 0)
+    std::cerr << "Impossibile accedere a " << cwd << ": " << strerror(errno) << std::endl;
+  else
+    res = compile(args);
+  std::cout.flush();
+  std::cerr.flush();
+  fflush(nullptr);
+  char status = res;
+  writeall(conn, &status, 1);
+  return res;
+}
+
+// Ogni connessione è servita da un processo figlio, creato con fork a partire dal
+// server già inizializzato: le richieste sono indipendenti (directory corrente,
+// descrittori, stato di LLVM) e vengono eseguite in parallelo; un errore fatale in
+// una compilazione termina solo il figlio che la esegue
+int serve(const std::string& path, compilefn compile) {
+  sockaddr_un addr;
+  if (!address(path, addr))
+    return 1;
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  // Socket rimasto da un server precedente; qualunque altro file non viene toccato
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path.c_str());
+  if (sock < 0 || bind(sock, (sockaddr*)&addr, sizeof addr) < 0 || listen(sock, SOMAXCONN) < 0) {
+    std::cerr << "Impossibile creare il socket " << path << ": " << strerror(errno) << std::endl;
+    return 1;
+  }
+  signal(SIGCHLD, SIG_IGN); // I figli terminati vengono rimossi automaticamente
+  for (;;) {
+    int conn = accept(sock, nullptr, nullptr);
+    if (conn < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "Errore sul socket " << path << ": " << strerror(errno) << std::endl;
+      return 1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      // La compilazione attende i processi che avvia (es. ld con -fparallel-codegen),
+      // il che non è possibile se SIGCHLD è ignorato
+      signal(SIGCHLD, SIG_DFL);
+      close(sock);
+      _exit(request(conn, compile));
+    }
+    if (pid < 0)
+      std::cerr << "Impossibile eseguire la richiesta: " << strerror(errno) << std::endl;
+    close(conn);
+  }
+}
+
+/********************************* Client *********************************/
+int client(const std::string& path, const std::vector<std::string>& args) {
+  sockaddr_un addr;
+  if (!address(path, addr))
+    return 1;
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0 || connect(sock, (sockaddr*)&addr, sizeof addr) < 0) {
+    std::cerr << "Impossibile connettersi al server " << path << ": " << strerror(errno) << std::endl;
+    return 1;
+  }
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof cwd)) {
+    std::cerr << "Directory corrente non disponibile: " << strerror(errno) << std::endl;
+    return 1;
+  }
+  std::string msg = std::to_string(args.size() + 1) + "\n" + cwd + '\0';
+  for (auto &a : args)
+    msg += a + '\0';
+
+  // I descrittori viaggiano con il primo byte della richiesta
+  int fds[3] = { 0, 1, 2 };
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof fds)];
+  iovec iov = { &msg[0], 1 };
+  msghdr mh = {};
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = control;
+  mh.msg_controllen = sizeof control;
+  cmsghdr *c = CMSG_FIRSTHDR(&mh);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof fds);
+  memcpy(CMSG_DATA(c), fds, sizeof fds);
+  char status;
+  if (sendmsg(sock, &mh, 0) != 1 || !writeall(sock, msg.data() + 1, msg.size() - 1)) {
+    std::cerr << "Impossibile inviare la richiesta al server " << path << std::endl;
+    return 1;
+  }
+  ssize_t n;
+  while ((n = read(sock, &status, 1)) < 0 && errno == EINTR)
+    ;
+  close(sock);
+  if (n != 1) {
+    std::cerr << "Compilazione interrotta dal server " << path << std::endl;
+    return 1;
+  }
+  return (unsigned char)status;
+}
@@ -0,0 +1,25 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+// Modalità server di kcomp: un processo "caldo" (librerie LLVM caricate e target
+// inizializzato) accetta richieste di compilazione su un socket Unix. Il client
+// invia la directory corrente e gli argomenti della linea di comando, insieme ai
+// propri stdin, stdout e stderr: ogni richiesta viene eseguita in un processo figlio
+// del server, con un driver nuovo, che scrive diagnostica e output direttamente sui
+// descrittori del client e gli restituisce infine il codice di uscita.
+// Il modulo non dipende da LLVM, in modo che il client (kclient) resti leggero
+#include <functional>
+#include <string>
+#include <vector>
+
+// Compilazione di una richiesta: riceve gli argomenti (il primo è il nome del
+// programma) e restituisce il codice di uscita
+typedef std::function<int(const std::vector<std::string>&)> compilefn;
+
+// Esegue il server sul socket path (non termina se non in caso di errore)
+int serve(const std::string& path, compilefn compile);
+
+// Invia al server sul socket path la compilazione con gli argomenti args (senza
+// il nome del programma) e ne restituisce il codice di uscita
+int client(const std::string& path, const std::vector<std::string>& args);
+
+#endif // ! SERVER_HPP
@@ -0,0 +1,18 @@
+#include <iostream>
+#include <vector>
+
+extern "C" {
+    double dot(double*, double*, double);
+    double scale(double*, double, double);
+}
+
+int main() {
+    double n;
+    std::cout << "Inserisci la dimensione n dei vettori: ";
+    std::cin >> n;
+    std::vector<double> x(n), y(n, 1.0);
+    for (size_t i = 0; i < x.size(); i++)
+        x[i] = i;
+    scale(y.data(), 2, n);
+    std::cout << "x.y = " << dot(x.data(), y.data(), n) << std::endl;
+}
@@ -0,0 +1,12 @@
+#include <iostream>
+
+extern "C" {
+    double pi(double);
+}
+
+int main() {
+    double n;
+    std::cout << "Inserisci il numero di punti n: ";
+    std::cin >> n;
+    std::cout << "pi ~ " << pi(n) << std::endl;
+}